@@ -0,0 +1,48 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Ast {
+
+Arena::Arena(size_t block_size) : block_size_(block_size) {
+}
+
+void *Arena::AllocateSlow(size_t size, size_t align) {
+  // Oversized requests get a block of their own.
+  size_t block_size = std::max(block_size_, size + align);
+  blocks_.push_back(
+      {std::unique_ptr<std::byte[]>(new std::byte[block_size]), block_size});
+  pos_ = blocks_.back().data.get();
+  end_ = pos_ + block_size;
+  return Allocate(size, align);
+}
+
+std::string_view Arena::CopyString(std::string_view text) {
+  if (text.empty()) {
+    return {};
+  }
+  auto *data = static_cast<char *>(Allocate(text.size(), 1));
+  std::memcpy(data, text.data(), text.size());
+  return {data, text.size()};
+}
+
+void Arena::Rewind(Mark mark) {
+  blocks_.resize(mark.blocks);
+  pos_ = mark.pos;
+  end_ = blocks_.empty() ? nullptr
+                         : blocks_.back().data.get() + blocks_.back().size;
+}
+
+size_t Arena::BytesUsed() const {
+  size_t result = 0;
+  for (const auto &block : blocks_) {
+    result += block.size;
+  }
+  if (!blocks_.empty()) {
+    result -= end_ - pos_;
+  }
+  return result;
+}
+
+} /* namespace Ast */
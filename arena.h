@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Ast {
+
+// Bump allocator for AST nodes and their child arrays. Objects are placed
+// contiguously in allocation order and are never destroyed one by one: the
+// whole arena is released at once, so everything put into it must be fine
+// without its destructor running (no owned heap memory).
+class Arena {
+ public:
+  explicit Arena(size_t block_size = 64 * 1024);
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *Allocate(size_t size, size_t align) {
+    auto pos = reinterpret_cast<uintptr_t>(pos_);
+    uintptr_t aligned = (pos + align - 1) & ~(uintptr_t(align) - 1);
+    if (aligned + size > reinterpret_cast<uintptr_t>(end_)) {
+      return AllocateSlow(size, align);
+    }
+    pos_ = reinterpret_cast<std::byte *>(aligned + size);
+    return reinterpret_cast<void *>(aligned);
+  }
+
+  template<typename T, typename... Args>
+  T *Make(Args &&...args) {
+    return new(Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  template<typename T>
+  std::span<const T> CopyArray(const std::vector<T> &items) {
+    if (items.empty()) {
+      return {};
+    }
+    auto *data = static_cast<T *>(Allocate(sizeof(T) * items.size(),
+                                           alignof(T)));
+    std::uninitialized_copy(items.begin(), items.end(), data);
+    return {data, items.size()};
+  }
+
+  std::string_view CopyString(std::string_view text);
+
+  // Position to Rewind to; everything allocated after it is then released.
+  struct Mark {
+    size_t blocks;
+    std::byte *pos;
+  };
+
+  Mark GetMark() const {
+    return {blocks_.size(), pos_};
+  }
+  // Nothing allocated after mark may be used afterwards.
+  void Rewind(Mark mark);
+
+  // Bytes taken from the blocks so far, including alignment padding.
+  size_t BytesUsed() const;
+  size_t BlockCount() const {
+    return blocks_.size();
+  }
+
+ private:
+  void *AllocateSlow(size_t size, size_t align);
+
+  struct Block {
+    std::unique_ptr<std::byte[]> data;
+    size_t size;
+  };
+
+  size_t block_size_;
+  std::vector<Block> blocks_;
+  std::byte *pos_ = nullptr;
+  std::byte *end_ = nullptr;
+};
+
+} /* namespace Ast */
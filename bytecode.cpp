@@ -0,0 +1,630 @@
+#include "bytecode.h"
+#include "arena.h"
+#include "comparators.h"
+#include "object.h"
+#include "operations.h"
+#include "region.h"
+#include "statement.h"
+
+#include <limits>
+#include <span>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Bytecode {
+
+namespace {
+
+constexpr Ast::Comparison::Comparator kComparators[] = {
+    Runtime::Equal,
+    Runtime::NotEqual,
+    Runtime::Less,
+    Runtime::Greater,
+    Runtime::LessOrEqual,
+    Runtime::GreaterOrEqual,
+};
+
+CompareOp CompareOpOf(Ast::Comparison::Comparator comparator) {
+  for (size_t i = 0; i < size(kComparators); ++i) {
+    if (kComparators[i] == comparator) {
+      return static_cast<CompareOp>(i);
+    }
+  }
+  throw logic_error("Unknown comparator");
+}
+
+// Method body of a class rebuilt by Machine: compiles the original body on
+// its first call and runs it on the machine.
+class MachineBody : public Ast::EngineBody {
+ public:
+  MachineBody(Machine &machine, const Runtime::Method &source)
+      : EngineBody(&machine), machine(machine), source(source) {
+  }
+
+  ObjectHolder Execute(Runtime::Closure &closure) override {
+    return machine.Run(GetCode(), closure);
+  }
+
+  void Accept(Ast::Visitor &) const override {
+    throw logic_error("Bytecode method bodies can't be visited");
+  }
+
+  const Code &GetCode() {
+    if (!code) {
+      code = &machine.Compile(*source.Body(), &source);
+    }
+    return *code;
+  }
+
+  Machine &machine;
+
+  // The body of method if it runs on machine, else null.
+  static MachineBody *Of(const Runtime::Method &method,
+                         const Machine &machine) {
+    Ast::Statement *body = method.Body();
+    if (body->kind != Ast::Kind::kEngineBody
+        || static_cast<Ast::EngineBody *>(body)->engine != &machine) {
+      return nullptr;
+    }
+    return static_cast<MachineBody *>(body);
+  }
+
+ private:
+  const Runtime::Method &source;
+  const Code *code = nullptr;
+};
+
+ObjectHolder &Slot(Runtime::Closure &closure, string_view name) {
+  if (auto it = closure.find(name); it != closure.end()) {
+    return it->second;
+  }
+  return closure.emplace(name, ObjectHolder{}).first->second;
+}
+
+// Value of a slot whose name isn't bound yet. Distinct from None, which is an
+// empty holder.
+class Unbound : public Runtime::Object {
+ public:
+  Unbound() : Object(Runtime::ObjectType::kOther) {
+  }
+
+  void Print(std::ostream &) override {
+    throw logic_error("Unbound slot printed");
+  }
+  bool IsTrue() const override {
+    return false;
+  }
+};
+
+const ObjectHolder &UnboundSlot() {
+  static Unbound unbound;
+  static const ObjectHolder holder = ObjectHolder::Share(unbound);
+  return holder;
+}
+
+} /* namespace */
+
+// Emits code for one statement tree. Every node leaves exactly one value on
+// the stack, except a return, which ends the frame wherever it is nested.
+class Compiler : public Ast::Visitor {
+ public:
+  Compiler(Machine &machine, Code &code) : machine_(machine), code_(code) {
+  }
+
+  void CompileBody(const Ast::Statement &body, const Runtime::Method *method) {
+    if (method) {
+      code_.method = true;
+      for (const std::string &param : method->formal_params) {
+        Slot(param);
+      }
+      code_.self_slot = Slot("self");
+    }
+    body.Accept(*this);
+    Emit(Op::kReturn);
+  }
+
+  void Visit(const Ast::NumericConst &node) override {
+    Emit(Op::kConst, machine_.Constant(node.value));
+  }
+
+  void Visit(const Ast::StringConst &node) override {
+    Emit(Op::kConst, machine_.Constant(node.value));
+  }
+
+  void Visit(const Ast::BoolConst &node) override {
+    Emit(Op::kConst, machine_.Constant(node.value));
+  }
+
+  void Visit(const Ast::VariableValue &node) override {
+    // Like Ast::VariableValue, only the variable and one field are looked at.
+    Load(node.dotted_ids[0]);
+    if (node.dotted_ids.size() > 1) {
+      Emit(Op::kLoadField, node.field, machine_.NewFieldCache());
+    }
+  }
+
+  void Visit(const Ast::Assignment &node) override {
+    node.right_value->Accept(*this);
+    Store(node.var_name);
+  }
+
+  void Visit(const Ast::FieldAssignment &node) override {
+    Visit(node.object);
+    node.right_value->Accept(*this);
+    Emit(Op::kStoreField, node.field, machine_.NewFieldCache());
+  }
+
+  void Visit(const Ast::None &) override {
+    Emit(Op::kNone);
+  }
+
+  void Visit(const Ast::Print &node) override {
+    // Each argument is evaluated after the text before it is written.
+    bool first = true;
+    for (const Ast::Statement *arg : node.Args()) {
+      if (!first) {
+        Emit(Op::kPrintSpace);
+      }
+      first = false;
+      arg->Accept(*this);
+      Emit(Op::kPrintValue);
+    }
+    Emit(Op::kPrintEnd);
+  }
+
+  void Visit(const Ast::MethodCall &node) override {
+    // The arguments are evaluated before the object.
+    CompileAll(node.args);
+    node.object->Accept(*this);
+    Emit(Op::kCall, node.selector, machine_.NewCache(),
+         Count(node.args.size()));
+  }
+
+  void Visit(const Ast::NewInstance &node) override {
+    // The arguments are only evaluated if there is an __init__ to pass them
+    // to.
+    uint16_t count = Count(node.args.size());
+    uint32_t cls = machine_.ClassIndex(node.class_);
+    size_t create = Emit(Op::kNew, cls, 0, count);
+    CompileAll(node.args);
+    Emit(Op::kInit, cls, 0, count);
+    Emit(Op::kPop);
+    code_.instructions[create].b = Here();
+  }
+
+  void Visit(const Ast::Stringify &node) override {
+    Unary(Op::kStringify, node);
+  }
+
+  void Visit(const Ast::Add &node) override {
+    Binary(Op::kAdd, node);
+  }
+
+  void Visit(const Ast::Sub &node) override {
+    Binary(Op::kSub, node);
+  }
+
+  void Visit(const Ast::Mult &node) override {
+    Binary(Op::kMult, node);
+  }
+
+  void Visit(const Ast::Div &node) override {
+    Binary(Op::kDiv, node);
+  }
+
+  void Visit(const Ast::Or &node) override {
+    Binary(Op::kOr, node);
+  }
+
+  void Visit(const Ast::And &node) override {
+    Binary(Op::kAnd, node);
+  }
+
+  void Visit(const Ast::Not &node) override {
+    Unary(Op::kNot, node);
+  }
+
+  void Visit(const Ast::Compound &node) override {
+    for (const Ast::Statement *statement : node.Statements()) {
+      statement->Accept(*this);
+      if (statement->kind == Ast::Kind::kReturn) {
+        // The rest of the block can't be reached.
+        return;
+      }
+      Emit(Op::kPop);
+    }
+    Emit(Op::kNone);
+  }
+
+  void Visit(const Ast::Return &node) override {
+    node.Value().Accept(*this);
+    Emit(Op::kReturn);
+  }
+
+  void Visit(const Ast::ClassDefinition &node) override {
+    auto cls = node.Class().TryAs<Runtime::Class>();
+    Emit(Op::kClass, machine_.ClassIndex(*cls));
+    Store(cls->GetName());
+    Emit(Op::kPop);
+    Emit(Op::kNone);
+  }
+
+  void Visit(const Ast::IfElse &node) override {
+    node.Condition().Accept(*this);
+    size_t to_else = Emit(Op::kJumpIfFalse);
+    node.IfBody().Accept(*this);
+    size_t to_end = Emit(Op::kJump);
+    code_.instructions[to_else].a = Here();
+    if (node.ElseBody()) {
+      node.ElseBody()->Accept(*this);
+    } else {
+      Emit(Op::kNone);
+    }
+    code_.instructions[to_end].a = Here();
+  }
+
+  void Visit(const Ast::Comparison &node) override {
+    node.Left().Accept(*this);
+    node.Right().Accept(*this);
+    Emit(Op::kCompare,
+         static_cast<uint32_t>(CompareOpOf(node.GetComparator())));
+  }
+
+ private:
+  Machine &machine_;
+  Code &code_;
+  unordered_map<string_view, uint32_t> slots_;
+
+  size_t Emit(Op op, uint32_t a = 0, uint32_t b = 0, uint16_t count = 0) {
+    code_.instructions.push_back({op, count, a, b});
+    return code_.instructions.size() - 1;
+  }
+
+  uint32_t Here() const {
+    return static_cast<uint32_t>(code_.instructions.size());
+  }
+
+  static uint16_t Count(size_t count) {
+    if (count > numeric_limits<uint16_t>::max()) {
+      throw runtime_error("Too many arguments");
+    }
+    return static_cast<uint16_t>(count);
+  }
+
+  uint32_t Slot(string_view name) {
+    auto [it, inserted] = slots_.emplace(
+        name, static_cast<uint32_t>(code_.slot_names.size()));
+    if (inserted) {
+      code_.slot_names.push_back(machine_.Name(name));
+    }
+    return it->second;
+  }
+
+  void Load(string_view name) {
+    if (code_.method) {
+      Emit(Op::kLoadLocal, Slot(name));
+    } else {
+      Emit(Op::kLoad, machine_.Name(name));
+    }
+  }
+
+  void Store(string_view name) {
+    if (!code_.method) {
+      Emit(Op::kStore, machine_.Name(name));
+      return;
+    }
+    Emit(Op::kStoreLocal, Slot(name));
+  }
+
+  void CompileAll(Ast::StatementList statements) {
+    for (const Ast::Statement *statement : statements) {
+      statement->Accept(*this);
+    }
+  }
+
+  void Unary(Op op, const Ast::UnaryOperation &node) {
+    node.Argument().Accept(*this);
+    Emit(op);
+  }
+
+  void Binary(Op op, const Ast::BinaryOperation &node) {
+    node.Lhs().Accept(*this);
+    node.Rhs().Accept(*this);
+    Emit(op);
+  }
+};
+
+Machine::Machine(const Ast::Program &program)
+    : program_(program), bodies_(make_unique<Ast::Arena>(4096)) {
+}
+
+Machine::~Machine() = default;
+
+ObjectHolder Machine::Execute(Runtime::Closure &closure) {
+  return Run(Compile(*program_.Root()), closure);
+}
+
+const Code &Machine::Compile(const Ast::Statement &body,
+                             const Runtime::Method *method) {
+  if (auto it = compiled_.find(&body); it != compiled_.end()) {
+    return *it->second;
+  }
+  // Bodies are compiled on their first call, during a run, but the machine
+  // keeps their code and constants.
+  Runtime::Region::Scope outside(nullptr);
+  Code &code = codes_.emplace_back();
+  Compiler(*this, code).CompileBody(body, method);
+  compiled_.emplace(&body, &code);
+  return code;
+}
+
+uint32_t Machine::Constant(const ObjectHolder &value) {
+  // Every literal node holds its own constant and is compiled once.
+  constants_.push_back(value);
+  return static_cast<uint32_t>(constants_.size() - 1);
+}
+
+uint32_t Machine::Name(string_view name) {
+  auto [it, inserted] = name_indices_.emplace(
+      name, static_cast<uint32_t>(names_.size()));
+  if (inserted) {
+    names_.push_back(name);
+  }
+  return it->second;
+}
+
+uint32_t Machine::NewCache() {
+  caches_.emplace_back();
+  return static_cast<uint32_t>(caches_.size() - 1);
+}
+
+uint32_t Machine::NewFieldCache() {
+  field_caches_.emplace_back();
+  return static_cast<uint32_t>(field_caches_.size() - 1);
+}
+
+uint32_t Machine::ClassIndex(const Runtime::Class &cls) {
+  if (auto it = class_indices_.find(&cls); it != class_indices_.end()) {
+    return it->second;
+  }
+  // The machine keeps its classes across runs, so not in a run's region.
+  Runtime::Region::Scope outside(nullptr);
+  const Runtime::ClassInfo &info = cls.Info();
+  const Runtime::Class *parent = info.parent
+      ? classes_[ClassIndex(*info.parent)].TryAs<Runtime::Class>() : nullptr;
+
+  vector<Runtime::Method> methods;
+  for (const auto &[name, method] : info.methods) {
+    Runtime::Method m;
+    m.name = method.name;
+    m.formal_params = method.formal_params;
+    m.body = bodies_->Make<MachineBody>(*this, method);
+    methods.push_back(std::move(m));
+  }
+
+  auto index = static_cast<uint32_t>(classes_.size());
+  const ObjectHolder &rebuilt = classes_.emplace_back(ObjectHolder::Own(
+      Runtime::Class(info.name, std::move(methods), parent)));
+  inits_.push_back(
+      rebuilt.TryAs<Runtime::Class>()->GetOperator(Runtime::Operator::kInit));
+  class_indices_.emplace(&cls, index);
+  return index;
+}
+
+ObjectHolder Machine::Run(const Code &code, Runtime::Closure &closure) {
+  size_t base_frame = frames_.size();
+  size_t base_stack = stack_.size();
+  if (code.method) {
+    FillSlots(code, base_stack, closure);
+  }
+  frames_.push_back({&code, 0, &closure, base_stack});
+  try {
+    return Loop(base_frame);
+  } catch (...) {
+    frames_.erase(frames_.begin() + base_frame, frames_.end());
+    stack_.erase(stack_.begin() + base_stack, stack_.end());
+    throw;
+  }
+}
+
+void Machine::Call(Runtime::ClassInstance &instance,
+                   const Runtime::Method &method, size_t count) {
+  MachineBody *body = MachineBody::Of(method, *this);
+  size_t base = stack_.size() - count;
+  if (!body) {
+    ObjectHolder result =
+        instance.Call(method, span(stack_).subspan(base, count));
+    stack_.resize(base);
+    stack_.push_back(std::move(result));
+    return;
+  }
+
+  // The arguments become the first slots, followed by self unless a
+  // parameter took its name.
+  const Code &code = body->GetCode();
+  stack_.resize(base + code.slot_names.size(), UnboundSlot());
+  if (code.self_slot >= count) {
+    stack_[base + code.self_slot] = instance.Self();
+  }
+  frames_.push_back({&code, 0, nullptr, base});
+}
+
+void Machine::FillSlots(const Code &code, size_t base,
+                        const Runtime::Closure &closure) {
+  stack_.resize(base + code.slot_names.size(), UnboundSlot());
+  for (size_t i = 0; i < code.slot_names.size(); ++i) {
+    if (auto it = closure.find(names_[code.slot_names[i]]);
+        it != closure.end()) {
+      stack_[base + i] = it->second;
+    }
+  }
+}
+
+ObjectHolder Machine::Loop(size_t base_frame) {
+  Frame *frame = &frames_.back();
+  auto pop = [this] {
+    ObjectHolder value = std::move(stack_.back());
+    stack_.pop_back();
+    return value;
+  };
+
+  while (true) {
+    const Instruction &instruction = frame->code->instructions[frame->pc++];
+    switch (instruction.op) {
+      case Op::kConst:
+        stack_.push_back(constants_[instruction.a]);
+        break;
+      case Op::kNone:
+        stack_.emplace_back();
+        break;
+      case Op::kLoad: {
+        auto it = frame->closure->find(names_[instruction.a]);
+        if (it == frame->closure->end()) {
+          throw runtime_error("No such variable!");
+        }
+        stack_.push_back(it->second);
+        break;
+      }
+      case Op::kLoadLocal: {
+        const ObjectHolder &value = stack_[frame->base + instruction.a];
+        if (value.Get() == UnboundSlot().Get()) {
+          throw runtime_error("No such variable!");
+        }
+        stack_.push_back(value);
+        break;
+      }
+      case Op::kLoadField: {
+        ObjectHolder &top = stack_.back();
+        ObjectHolder *field = field_caches_[instruction.b].Find(
+            Runtime::AsInstance(top), instruction.a);
+        // Copied before top lets go of the instance holding it.
+        ObjectHolder value = field ? *field : ObjectHolder::None();
+        top = std::move(value);
+        break;
+      }
+      case Op::kStore:
+        Slot(*frame->closure, names_[instruction.a]) = stack_.back();
+        break;
+      case Op::kStoreLocal:
+        stack_[frame->base + instruction.a] = stack_.back();
+        break;
+      case Op::kStoreField: {
+        ObjectHolder value = pop();
+        ObjectHolder &top = stack_.back();
+        field_caches_[instruction.b].Get(Runtime::AsInstance(top),
+                                         instruction.a) = value;
+        top = std::move(value);
+        break;
+      }
+      case Op::kPrintSpace:
+        Ast::Print::OutputStream() << ' ';
+        break;
+      case Op::kPrintValue:
+        Runtime::PrintValue(pop(), Ast::Print::OutputStream());
+        break;
+      case Op::kPrintEnd:
+        Ast::Print::OutputStream() << '\n';
+        stack_.emplace_back();
+        break;
+      case Op::kCall: {
+        ObjectHolder object = pop();
+        Runtime::ClassInstance &instance = Runtime::AsInstance(object);
+        const Runtime::Method *method = caches_[instruction.b].Lookup(
+            instance.GetClass(), instruction.a, cache_stats_);
+        Call(instance,
+             Runtime::CheckCall(method, instruction.a, instruction.count),
+             instruction.count);
+        frame = &frames_.back();
+        break;
+      }
+      case Op::kNew: {
+        const auto &cls = *classes_[instruction.a].TryAs<Runtime::Class>();
+        stack_.push_back(Runtime::ClassInstance::Create(cls));
+        const Runtime::Method *init = inits_[instruction.a];
+        if (!init || init->formal_params.size() != instruction.count) {
+          frame->pc = instruction.b;
+        }
+        break;
+      }
+      case Op::kInit: {
+        ObjectHolder &object = stack_.end()[-1 - instruction.count];
+        Call(Runtime::AsInstance(object), *inits_[instruction.a],
+             instruction.count);
+        frame = &frames_.back();
+        break;
+      }
+      case Op::kStringify:
+        stack_.back() = Runtime::Stringify(std::move(stack_.back()));
+        break;
+      case Op::kAdd: {
+        ObjectHolder rhs = pop();
+        stack_.back() = Runtime::Add(std::move(stack_.back()), std::move(rhs));
+        break;
+      }
+      case Op::kSub: {
+        ObjectHolder rhs = pop();
+        stack_.back() = Runtime::Sub(std::move(stack_.back()), std::move(rhs));
+        break;
+      }
+      case Op::kMult: {
+        ObjectHolder rhs = pop();
+        stack_.back() = Runtime::Mult(std::move(stack_.back()),
+                                      std::move(rhs));
+        break;
+      }
+      case Op::kDiv: {
+        ObjectHolder rhs = pop();
+        stack_.back() = Runtime::Div(std::move(stack_.back()), std::move(rhs));
+        break;
+      }
+      case Op::kOr: {
+        ObjectHolder rhs = pop();
+        stack_.back() = Runtime::Or(stack_.back(), rhs);
+        break;
+      }
+      case Op::kAnd: {
+        ObjectHolder rhs = pop();
+        stack_.back() = Runtime::And(stack_.back(), rhs);
+        break;
+      }
+      case Op::kNot:
+        stack_.back() = Runtime::Not(stack_.back());
+        break;
+      case Op::kCompare: {
+        ObjectHolder rhs = pop();
+        bool result = kComparators[instruction.a](std::move(stack_.back()),
+                                                  std::move(rhs));
+        stack_.back() = ObjectHolder::Own(Runtime::Bool(result));
+        break;
+      }
+      case Op::kClass:
+        stack_.push_back(classes_[instruction.a]);
+        break;
+      case Op::kPop:
+        stack_.pop_back();
+        break;
+      case Op::kJump:
+        frame->pc = instruction.a;
+        break;
+      case Op::kJumpIfFalse:
+        if (!Runtime::IsTrue(pop())) {
+          frame->pc = instruction.a;
+        }
+        break;
+      case Op::kReturn: {
+        ObjectHolder result = pop();
+        stack_.resize(frame->base);
+        frames_.pop_back();
+        if (frames_.size() == base_frame) {
+          return result;
+        }
+        stack_.push_back(std::move(result));
+        frame = &frames_.back();
+        break;
+      }
+    }
+  }
+}
+
+} /* namespace Bytecode */
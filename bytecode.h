@@ -0,0 +1,203 @@
+#pragma once
+
+#include "inline_cache.h"
+#include "object_holder.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Ast {
+class Program;
+class Arena;
+struct Statement;
+}
+
+namespace Runtime {
+class Class;
+class ClassInstance;
+struct Method;
+}
+
+namespace Bytecode {
+
+// Instructions of the stack machine, with the operands each uses and what it
+// does to the operand stack (top on the right):
+//   kConst           a: constant               -> value
+//   kNone                                      -> None
+//   kLoad            a: name                   -> value of the variable
+//   kLoadLocal       a: slot                   -> value of the local
+//   kLoadField       a: field, b: cache  instance -> value of the field
+//   kStore           a: name             value -> value
+//   kStoreLocal      a: slot             value -> value
+//   kStoreField      a: field, b: cache
+//                               instance value -> value
+//   kPrintSpace                                -> (writes a separator)
+//   kPrintValue                          value -> (writes the value)
+//   kPrintEnd                                  -> None (ends the line)
+//   kCall            a: selector, b: cache, count
+//                                args... instance -> result
+//   kNew             a: class, count, b: target -> instance
+//                    (then jumps to target unless the class has an __init__
+//                    taking count arguments)
+//   kInit            a: class, count
+//                                instance args... -> instance result
+//   kStringify, kNot                     value -> result
+//   kAdd ... kAnd                      lhs rhs -> result
+//   kCompare         a: CompareOp      lhs rhs -> Bool
+//   kClass           a: class                  -> class
+//   kPop                                 value ->
+//   kJump            a: target
+//   kJumpIfFalse     a: target           value ->
+//   kReturn                              value -> (ends the frame)
+enum class Op : uint8_t {
+  kConst,
+  kNone,
+  kLoad,
+  kLoadLocal,
+  kLoadField,
+  kStore,
+  kStoreLocal,
+  kStoreField,
+  kPrintSpace,
+  kPrintValue,
+  kPrintEnd,
+  kCall,
+  kNew,
+  kInit,
+  kStringify,
+  kAdd,
+  kSub,
+  kMult,
+  kDiv,
+  kOr,
+  kAnd,
+  kNot,
+  kCompare,
+  kClass,
+  kPop,
+  kJump,
+  kJumpIfFalse,
+  kReturn,
+};
+
+enum class CompareOp : uint32_t {
+  kEqual,
+  kNotEqual,
+  kLess,
+  kGreater,
+  kLessOrEqual,
+  kGreaterOrEqual,
+};
+
+struct Instruction {
+  Op op;
+  uint16_t count = 0;
+  uint32_t a = 0;
+  uint32_t b = 0;
+};
+
+// Compiled top level or method body. Jump targets are instruction indices.
+//
+// The top level reads and writes its variables by name in the closure it runs
+// in. A method body instead keeps every name it uses in a slot of its frame,
+// resolved when it is compiled: the parameters come first, in order, then the
+// other names as they first appear, self first among them. A call fills the
+// slots the way Runtime::ClassInstance::Call fills its closure: the arguments
+// and self; the rest start unbound.
+struct Code {
+  std::vector<Instruction> instructions;
+  bool method = false;
+  // Name of each slot, indexing the machine's names.
+  std::vector<uint32_t> slot_names;
+  // Slot of self in a method body; one of the parameters if it is named so.
+  uint32_t self_slot = 0;
+};
+
+// Runs a parsed program as bytecode. Each statement tree is compiled on first
+// use into a Code whose constants, names and classes index the machine's
+// pools; a method body is compiled the first time it is called, so a lazy
+// parse stays lazy. Classes are rebuilt as Runtime::Class objects whose
+// methods run on this machine, so instances behave exactly as with the tree
+// walker. A call from one compiled method to another pushes a frame instead
+// of recursing. The machine must outlive the closures it runs in.
+class Machine {
+ public:
+  explicit Machine(const Ast::Program &program);
+  ~Machine();
+
+  ObjectHolder Execute(Runtime::Closure &closure);
+  // Runs code until it returns. Re-entrant: used by method bodies called from
+  // outside the machine, e.g. a __str__ called while printing. A method body
+  // takes its slots from closure.
+  ObjectHolder Run(const Code &code, Runtime::Closure &closure);
+
+  // Compiles the top level, or the body of method if it is given.
+  const Code &Compile(const Ast::Statement &body,
+                      const Runtime::Method *method = nullptr);
+
+  // Hits and misses of the inline caches of the method call sites.
+  const Runtime::CacheStats &CacheStats() const {
+    return cache_stats_;
+  }
+
+ private:
+  friend class Compiler;
+
+  struct Frame {
+    const Code *code;
+    size_t pc;
+    // Variables of the top level; for a method body, the closure it was
+    // called with, or null when it was called from the machine.
+    Runtime::Closure *closure;
+    // Position of the first slot on the operand stack.
+    size_t base;
+  };
+
+  uint32_t Constant(const ObjectHolder &value);
+  uint32_t Name(std::string_view name);
+  // Rebuilds a class of the program (or of a module it was linked with) on
+  // first use.
+  uint32_t ClassIndex(const Runtime::Class &cls);
+
+  ObjectHolder Loop(size_t base_frame);
+  // Gives a call site its own inline cache.
+  uint32_t NewCache();
+  // Gives a field access site its own cache.
+  uint32_t NewFieldCache();
+
+  // Pops count arguments and calls method of instance: pushes a frame if the
+  // method is compiled here, otherwise pushes the result.
+  void Call(Runtime::ClassInstance &instance, const Runtime::Method &method,
+            size_t count);
+  // Pushes the slots of code from base, taking the values of those closure
+  // binds.
+  void FillSlots(const Code &code, size_t base,
+                 const Runtime::Closure &closure);
+
+  const Ast::Program &program_;
+  std::deque<Code> codes_;
+  std::unordered_map<const Ast::Statement *, const Code *> compiled_;
+
+  std::vector<ObjectHolder> constants_;
+  std::vector<std::string_view> names_;
+  std::unordered_map<std::string_view, uint32_t> name_indices_;
+  std::deque<ObjectHolder> classes_;
+  // Runtime::Operator::kInit of each class.
+  std::vector<const Runtime::Method *> inits_;
+  std::unordered_map<const Runtime::Class *, uint32_t> class_indices_;
+  std::unique_ptr<Ast::Arena> bodies_;
+  std::vector<Runtime::InlineCache> caches_;
+  std::vector<Runtime::FieldCache> field_caches_;
+  Runtime::CacheStats cache_stats_;
+
+  std::vector<ObjectHolder> stack_;
+  // A deque, so that a running loop's frame stays put while operations it
+  // calls into run methods on nested loops.
+  std::deque<Frame> frames_;
+};
+
+} /* namespace Bytecode */
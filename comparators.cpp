@@ -1,47 +1,67 @@
-#include "comparators.h"
-#include "object.h"
-#include "object_holder.h"
-
-#include <functional>
-#include <optional>
-#include <sstream>
-
-using namespace std;
-
-namespace Runtime {
-
-bool Equal(ObjectHolder lhs, ObjectHolder rhs) {
-  if ((lhs.TryAs<Class>()) && (rhs.TryAs<Class>())) {
-    return lhs.TryAs<Class>()->GetName() == rhs.TryAs<Class>()->GetName();
-  }
-  if ((lhs.TryAs<ClassInstance>()) && (rhs.TryAs<ClassInstance>())) {
-    if (lhs.TryAs<ClassInstance>()->class_.GetName()
-        == rhs.TryAs<ClassInstance>()->class_.GetName()) {
-      std::ostringstream one, two;
-      lhs->Print(one);
-      rhs->Print(two);
-
-      return (one.str() == two.str());
-    }
-    return false;
-  }
-
-  std::ostringstream one, two;
-  lhs->Print(one);
-  rhs->Print(two);
-  return one.str() == two.str();
-}
-
-bool Less(ObjectHolder lhs, ObjectHolder rhs) {
-  if ((lhs.TryAs<Number>()) && (rhs.TryAs<Number>())) {
-    return (lhs.TryAs<Number>()->GetValue() < rhs.TryAs<Number>()->GetValue());
-  }
-
-  if ((lhs.TryAs<String>()) && (rhs.TryAs<String>())) {
-    return (lhs.TryAs<String>()->GetValue() < rhs.TryAs<String>()->GetValue());
-  }
-
-  throw runtime_error("Bad comparison");
-}
-} /* namespace Runtime */
-
+#include "comparators.h"
+#include "object.h"
+#include "object_holder.h"
+
+#include <functional>
+#include <optional>
+#include <sstream>
+
+using namespace std;
+
+namespace Runtime {
+
+namespace {
+template<typename T>
+auto ValueOf(const ObjectHolder &object) {
+  return object.TryAs<T>()->GetValue();
+}
+}
+
+bool Equal(ObjectHolder lhs, ObjectHolder rhs) {
+  // Values of the same type compare directly; anything else by what it
+  // prints.
+  ObjectType type = lhs.Type();
+  if (type == rhs.Type()) {
+    switch (type) {
+      case ObjectType::kNumber:
+        return ValueOf<Number>(lhs) == ValueOf<Number>(rhs);
+      case ObjectType::kString:
+        return ValueOf<String>(lhs) == ValueOf<String>(rhs);
+      case ObjectType::kBool:
+        return ValueOf<Bool>(lhs) == ValueOf<Bool>(rhs);
+      case ObjectType::kClass:
+        return lhs.TryAs<Class>()->GetName() == rhs.TryAs<Class>()->GetName();
+      case ObjectType::kClassInstance:
+        if (lhs.TryAs<ClassInstance>()->class_.GetName()
+            != rhs.TryAs<ClassInstance>()->class_.GetName()) {
+          return false;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  std::ostringstream one, two;
+  lhs->Print(one);
+  rhs->Print(two);
+  return one.str() == two.str();
+}
+
+bool Less(ObjectHolder lhs, ObjectHolder rhs) {
+  ObjectType type = lhs.Type();
+  if (type == rhs.Type()) {
+    switch (type) {
+      case ObjectType::kNumber:
+        return ValueOf<Number>(lhs) < ValueOf<Number>(rhs);
+      case ObjectType::kString:
+        return ValueOf<String>(lhs) < ValueOf<String>(rhs);
+      default:
+        break;
+    }
+  }
+
+  throw runtime_error("Bad comparison");
+}
+} /* namespace Runtime */
+
@@ -0,0 +1,102 @@
+#include "engine.h"
+#include "bytecode.h"
+#include "flat_ast.h"
+#include "object.h"
+#include "region.h"
+#include "statement.h"
+
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+Engine EngineFromName(string_view name) {
+  if (name == "tree") {
+    return Engine::kTree;
+  } else if (name == "flat") {
+    return Engine::kFlat;
+  } else if (name == "bytecode") {
+    return Engine::kBytecode;
+  }
+  throw invalid_argument("Unknown engine " + string(name));
+}
+
+ProgramRunner::ProgramRunner(const Ast::Program &program, Engine engine)
+    : program_(program), engine_(engine) {
+  switch (engine) {
+    case Engine::kTree:
+      break;
+    case Engine::kFlat:
+      flat_ = Flat::Lower(program);
+      flat_executor_ = make_unique<Flat::Executor>(*flat_);
+      break;
+    case Engine::kBytecode:
+      machine_ = make_unique<Bytecode::Machine>(program);
+      break;
+  }
+}
+
+ProgramRunner::~ProgramRunner() = default;
+
+namespace {
+// Frees the instance cycles left by a run in a region, before it goes.
+struct CollectCycles {
+  ~CollectCycles() {
+    Runtime::Heap::Local().Collect();
+  }
+};
+
+ObjectHolder CopyOut(const ObjectHolder &value) {
+  switch (value.Type()) {
+    case Runtime::ObjectType::kString:
+      return ObjectHolder::Own(
+          Runtime::String(string(value.TryAs<Runtime::String>()->GetValue())));
+    case Runtime::ObjectType::kNone:
+    case Runtime::ObjectType::kNumber:
+    case Runtime::ObjectType::kBool:
+      return value;
+    default:
+      throw runtime_error("Only values can be returned from a region run");
+  }
+}
+}
+
+ObjectHolder ProgramRunner::Execute(Runtime::Closure &closure) {
+  switch (engine_) {
+    case Engine::kTree:
+      return program_.Root()->Execute(closure);
+    case Engine::kFlat:
+      return flat_executor_->Execute(closure);
+    case Engine::kBytecode:
+      return machine_->Execute(closure);
+  }
+  throw logic_error("Unknown engine");
+}
+
+ObjectHolder ProgramRunner::ExecuteInRegion() {
+  Runtime::Region region;
+  CollectCycles collect_cycles;
+  ObjectHolder result;
+  {
+    Runtime::Region::Scope scope(&region);
+    Runtime::Closure closure;
+    result = Execute(closure);
+  }
+  return CopyOut(result);
+}
+
+Runtime::CacheStats ProgramRunner::CacheStats() const {
+  switch (engine_) {
+    case Engine::kTree:
+      return Ast::MethodCall::Stats();
+    case Engine::kFlat:
+      return {};
+    case Engine::kBytecode:
+      return machine_->CacheStats();
+  }
+  throw logic_error("Unknown engine");
+}
+
+const Runtime::HeapStats &ProgramRunner::HeapStats() const {
+  return Runtime::Heap::Local().Stats();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "heap.h"
+#include "inline_cache.h"
+#include "object_holder.h"
+
+#include <memory>
+#include <string_view>
+
+namespace Ast {
+class Program;
+}
+
+namespace Flat {
+struct Program;
+class Executor;
+}
+
+namespace Bytecode {
+class Machine;
+}
+
+// The ways a parsed program can be run. All of them behave the same; they
+// differ in speed and memory use.
+enum class Engine {
+  kTree,      // Ast::Statement::Execute
+  kFlat,      // Flat::Executor
+  kBytecode,  // Bytecode::Machine
+};
+
+// "tree", "flat" or "bytecode". Throws std::invalid_argument for anything
+// else.
+Engine EngineFromName(std::string_view name);
+
+// Runs a parsed program on the chosen engine. The program must outlive the
+// runner, and the runner the closures it runs in: the classes they hold call
+// back into it.
+class ProgramRunner {
+ public:
+  ProgramRunner(const Ast::Program &program, Engine engine);
+  ~ProgramRunner();
+
+  ObjectHolder Execute(Runtime::Closure &closure);
+  // Runs the program in a closure of its own, with the objects it makes in a
+  // Runtime::Region dropped when the run ends. A number, string, boolean or
+  // None it returns is copied out; a class or instance is rejected with
+  // std::runtime_error.
+  ObjectHolder ExecuteInRegion();
+
+  // Method call cache hits and misses so far. The tree walker's are shared by
+  // every tree-walked program; the flat executor has no caches.
+  Runtime::CacheStats CacheStats() const;
+  // Collections and live instances of this thread's heap, which every runner
+  // on the thread shares.
+  const Runtime::HeapStats &HeapStats() const;
+
+ private:
+  const Ast::Program &program_;
+  Engine engine_;
+  std::unique_ptr<Flat::Program> flat_;
+  std::unique_ptr<Flat::Executor> flat_executor_;
+  std::unique_ptr<Bytecode::Machine> machine_;
+};
@@ -0,0 +1,525 @@
+#include "flat_ast.h"
+#include "comparators.h"
+#include "object.h"
+#include "operations.h"
+#include "statement.h"
+#include "symbol_table.h"
+
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+namespace Flat {
+
+namespace {
+
+class Lowerer : public Ast::Visitor {
+ public:
+  explicit Lowerer(Program &program) : program_(program) {
+  }
+
+  Index Lower(const Ast::Statement &node) {
+    node.Accept(*this);
+    return last_;
+  }
+
+  void Visit(const Ast::NumericConst &node) override {
+    int value = node.value.TryAs<Runtime::Number>()->GetValue();
+    Emit(Kind::kNumber, Constant(numbers_, value, node.value));
+  }
+
+  void Visit(const Ast::StringConst &node) override {
+    string value(node.value.TryAs<Runtime::String>()->GetValue());
+    Emit(Kind::kString, Constant(strings_, value, node.value));
+  }
+
+  void Visit(const Ast::BoolConst &node) override {
+    bool value = node.value.TryAs<Runtime::Bool>()->GetValue();
+    Emit(Kind::kBool, Constant(bools_, value, node.value));
+  }
+
+  void Visit(const Ast::VariableValue &node) override {
+    // Like Ast::VariableValue, only the variable and one field are looked at.
+    Index field = node.dotted_ids.size() > 1 ? Name(node.dotted_ids[1])
+                                             : kNoIndex;
+    Emit(Kind::kVariable, Name(node.dotted_ids[0]), field);
+  }
+
+  void Visit(const Ast::Assignment &node) override {
+    Index name = Name(node.var_name);
+    Emit(Kind::kAssignment, name, Lower(*node.right_value));
+  }
+
+  void Visit(const Ast::FieldAssignment &node) override {
+    Index object = Lower(node.object);
+    Index field = Name(node.field_name);
+    Emit(Kind::kFieldAssignment, object, field, Lower(*node.right_value));
+  }
+
+  void Visit(const Ast::None &) override {
+    Emit(Kind::kNone);
+  }
+
+  void Visit(const Ast::Print &node) override {
+    Emit(Kind::kPrint, LowerList(node.Args()));
+  }
+
+  void Visit(const Ast::MethodCall &node) override {
+    Index object = Lower(*node.object);
+    Index method = Name(node.method);
+    Emit(Kind::kMethodCall, object, method, LowerList(node.args));
+  }
+
+  void Visit(const Ast::NewInstance &node) override {
+    Emit(Kind::kNewInstance, ClassIndex(&node.class_), LowerList(node.args));
+  }
+
+  void Visit(const Ast::Stringify &node) override {
+    Emit(Kind::kStringify, Lower(node.Argument()));
+  }
+
+  void Visit(const Ast::Add &node) override {
+    Binary(Kind::kAdd, node);
+  }
+
+  void Visit(const Ast::Sub &node) override {
+    Binary(Kind::kSub, node);
+  }
+
+  void Visit(const Ast::Mult &node) override {
+    Binary(Kind::kMult, node);
+  }
+
+  void Visit(const Ast::Div &node) override {
+    Binary(Kind::kDiv, node);
+  }
+
+  void Visit(const Ast::Or &node) override {
+    Binary(Kind::kOr, node);
+  }
+
+  void Visit(const Ast::And &node) override {
+    Binary(Kind::kAnd, node);
+  }
+
+  void Visit(const Ast::Not &node) override {
+    Emit(Kind::kNot, Lower(node.Argument()));
+  }
+
+  void Visit(const Ast::Compound &node) override {
+    Emit(Kind::kCompound, LowerList(node.Statements()));
+  }
+
+  void Visit(const Ast::Return &node) override {
+    Emit(Kind::kReturn, Lower(node.Value()));
+  }
+
+  void Visit(const Ast::ClassDefinition &node) override {
+    auto cls = node.Class().TryAs<Runtime::Class>();
+    Emit(Kind::kClassDefinition, DefineClass(*cls));
+  }
+
+  void Visit(const Ast::IfElse &node) override {
+    Index condition = Lower(node.Condition());
+    Index if_body = Lower(node.IfBody());
+    Index else_body = node.ElseBody() ? Lower(*node.ElseBody()) : kNoIndex;
+    Emit(Kind::kIfElse, condition, if_body, else_body);
+  }
+
+  void Visit(const Ast::Comparison &node) override {
+    Index lhs = Lower(node.Left());
+    Index rhs = Lower(node.Right());
+    Emit(Kind::kComparison, lhs, rhs,
+         static_cast<Index>(CompareOpOf(node.GetComparator())));
+  }
+
+ private:
+  Program &program_;
+  Index last_ = kNoIndex;
+  unordered_map<string_view, Index> name_indices_;
+  unordered_map<const Runtime::Class *, Index> class_indices_;
+  unordered_map<int, Index> numbers_;
+  unordered_map<string, Index> strings_;
+  unordered_map<bool, Index> bools_;
+
+  void Emit(Kind kind, Index a = kNoIndex, Index b = kNoIndex,
+            Index c = kNoIndex) {
+    last_ = static_cast<Index>(program_.kinds.size());
+    program_.kinds.push_back(kind);
+    program_.operands.push_back({a, b, c});
+  }
+
+  void Binary(Kind kind, const Ast::BinaryOperation &node) {
+    Index lhs = Lower(node.Lhs());
+    Emit(kind, lhs, Lower(node.Rhs()));
+  }
+
+  // Equal literals share one pool entry.
+  template<typename Key>
+  Index Constant(unordered_map<Key, Index> &known, const Key &key,
+                 const ObjectHolder &value) {
+    auto [it, inserted] = known.emplace(
+        key, static_cast<Index>(program_.constants.size()));
+    if (inserted) {
+      program_.constants.push_back(value);
+    }
+    return it->second;
+  }
+
+  Index Name(string_view name) {
+    if (auto it = name_indices_.find(name); it != name_indices_.end()) {
+      return it->second;
+    }
+    // Class and method names belong to the Ast program; keep a copy that
+    // outlives it.
+    auto &symbols = Runtime::SymbolTable::Global();
+    string_view stored = symbols.Name(symbols.Intern(name));
+    auto index = static_cast<Index>(program_.names.size());
+    program_.names.push_back(stored);
+    name_indices_.emplace(stored, index);
+    return index;
+  }
+
+  Index List(const vector<Index> &items) {
+    auto result = static_cast<Index>(program_.lists.size());
+    program_.lists.push_back(static_cast<Index>(items.size()));
+    program_.lists.insert(program_.lists.end(), items.begin(), items.end());
+    return result;
+  }
+
+  Index LowerList(Ast::StatementList statements) {
+    vector<Index> items;
+    items.reserve(statements.size());
+    for (const Ast::Statement *statement : statements) {
+      items.push_back(Lower(*statement));
+    }
+    return List(items);
+  }
+
+  Index ClassIndex(const Runtime::Class *cls) {
+    auto it = class_indices_.find(cls);
+    if (it == class_indices_.end()) {
+      throw logic_error("Class " + cls->GetName() + " used before definition");
+    }
+    return it->second;
+  }
+
+  Index DefineClass(const Runtime::Class &cls) {
+    const Runtime::ClassInfo &info = cls.Info();
+
+    ClassEntry entry{};
+    entry.name = Name(info.name);
+    entry.parent = info.parent ? ClassIndex(info.parent) : kNoIndex;
+    entry.first_method = static_cast<Index>(program_.methods.size());
+    entry.method_count = static_cast<Index>(info.methods.size());
+    // Reserve the rows first: bodies may contain nested definitions.
+    program_.methods.resize(program_.methods.size() + info.methods.size());
+
+    Index method_index = entry.first_method;
+    for (const auto &[name, method] : info.methods) {
+      vector<Index> params;
+      for (const auto &param : method.formal_params) {
+        params.push_back(Name(param));
+      }
+      MethodEntry lowered{Name(method.name), List(params),
+                          Lower(*method.Body())};
+      program_.methods[method_index++] = lowered;
+    }
+
+    auto index = static_cast<Index>(program_.classes.size());
+    program_.classes.push_back(entry);
+    class_indices_[&cls] = index;
+    return index;
+  }
+
+  static CompareOp CompareOpOf(Ast::Comparison::Comparator comparator) {
+    if (comparator == Runtime::Equal) return CompareOp::kEqual;
+    if (comparator == Runtime::NotEqual) return CompareOp::kNotEqual;
+    if (comparator == Runtime::Less) return CompareOp::kLess;
+    if (comparator == Runtime::Greater) return CompareOp::kGreater;
+    if (comparator == Runtime::LessOrEqual) return CompareOp::kLessOrEqual;
+    if (comparator == Runtime::GreaterOrEqual) {
+      return CompareOp::kGreaterOrEqual;
+    }
+    throw logic_error("Unknown comparator");
+  }
+};
+
+bool Compare(CompareOp op, ObjectHolder lhs, ObjectHolder rhs) {
+  switch (op) {
+    case CompareOp::kEqual:
+      return Runtime::Equal(std::move(lhs), std::move(rhs));
+    case CompareOp::kNotEqual:
+      return Runtime::NotEqual(std::move(lhs), std::move(rhs));
+    case CompareOp::kLess:
+      return Runtime::Less(std::move(lhs), std::move(rhs));
+    case CompareOp::kGreater:
+      return Runtime::Greater(std::move(lhs), std::move(rhs));
+    case CompareOp::kLessOrEqual:
+      return Runtime::LessOrEqual(std::move(lhs), std::move(rhs));
+    case CompareOp::kGreaterOrEqual:
+      return Runtime::GreaterOrEqual(std::move(lhs), std::move(rhs));
+  }
+  throw logic_error("Unknown comparison");
+}
+
+// Method body of a class rebuilt by Executor: runs the flat subtree.
+class FlatBody : public Ast::EngineBody {
+ public:
+  FlatBody(Executor &executor, Index body)
+      : EngineBody(&executor), executor(executor), body(body) {
+  }
+
+  ObjectHolder Execute(Runtime::Closure &closure) override {
+    return executor.Execute(body, closure);
+  }
+
+  void Accept(Ast::Visitor &) const override {
+    throw logic_error("Flat method bodies can't be visited");
+  }
+
+ private:
+  Executor &executor;
+  Index body;
+};
+
+ObjectHolder &Slot(Runtime::Closure &closure, string_view name) {
+  if (auto it = closure.find(name); it != closure.end()) {
+    return it->second;
+  }
+  return closure.emplace(name, ObjectHolder{}).first->second;
+}
+
+// Arguments of one call, pushed onto the executor's argument stack above
+// those of the calls in progress, and popped when the call is over.
+class ArgumentScope {
+ public:
+  explicit ArgumentScope(vector<ObjectHolder> &stack)
+      : stack_(stack), base_(stack.size()) {
+  }
+
+  ~ArgumentScope() {
+    stack_.resize(base_);
+  }
+
+  span<const ObjectHolder> Values() const {
+    return span(stack_).subspan(base_);
+  }
+
+ private:
+  vector<ObjectHolder> &stack_;
+  size_t base_;
+};
+
+} /* namespace */
+
+size_t Program::MemoryUsage() const {
+  return kinds.size() * sizeof(Kind)
+      + operands.size() * sizeof(operands[0])
+      + lists.size() * sizeof(Index)
+      + names.size() * sizeof(string_view)
+      + constants.size() * sizeof(ObjectHolder)
+      + classes.size() * sizeof(ClassEntry)
+      + methods.size() * sizeof(MethodEntry);
+}
+
+unique_ptr<Program> Lower(const Ast::Program &program) {
+  auto result = make_unique<Program>();
+  result->root = Lowerer(*result).Lower(*program.Root());
+  return result;
+}
+
+Executor::Executor(const Program &program)
+    : program_(program), bodies_(make_unique<Ast::Arena>(4096)) {
+  selectors_.reserve(program.names.size());
+  for (string_view name : program.names) {
+    selectors_.push_back(Runtime::Intern(name));
+  }
+  field_caches_.resize(program.names.size());
+  for (const ClassEntry &entry : program.classes) {
+    vector<Runtime::Method> methods;
+    for (Index i = 0; i < entry.method_count; ++i) {
+      const MethodEntry &method = program.methods[entry.first_method + i];
+      Runtime::Method m;
+      m.name = program.names[method.name];
+      Index params = method.params;
+      for (Index p = 1; p <= program.lists[params]; ++p) {
+        m.formal_params.emplace_back(program.names[program.lists[params + p]]);
+      }
+      m.body = bodies_->Make<FlatBody>(*this, method.body);
+      methods.push_back(std::move(m));
+    }
+    const Runtime::Class *parent = entry.parent == kNoIndex ? nullptr
+        : classes_[entry.parent].TryAs<Runtime::Class>();
+    classes_.push_back(ObjectHolder::Own(Runtime::Class(
+        string(program.names[entry.name]), std::move(methods), parent)));
+  }
+}
+
+Executor::~Executor() = default;
+
+ObjectHolder Executor::Execute(Runtime::Closure &closure) {
+  return Execute(program_.root, closure);
+}
+
+Ast::Completion Executor::Run(Index statement, Runtime::Closure &closure) {
+  const auto &[a, b, c] = program_.operands[statement];
+  switch (program_.kinds[statement]) {
+    case Kind::kReturn:
+      return {Execute(a, closure), true};
+    case Kind::kCompound:
+      return RunList(a, closure);
+    case Kind::kIfElse:
+      if (Runtime::IsTrue(Execute(a, closure))) {
+        return Run(b, closure);
+      } else if (c != kNoIndex) {
+        return Run(c, closure);
+      }
+      return {};
+    default:
+      Execute(statement, closure);
+      return {};
+  }
+}
+
+Ast::Completion Executor::RunList(Index list, Runtime::Closure &closure) {
+  Index count = program_.lists[list];
+  for (Index i = 1; i <= count; ++i) {
+    Ast::Completion completion = Run(program_.lists[list + i], closure);
+    if (completion.returned) {
+      return completion;
+    }
+  }
+  return {};
+}
+
+void Executor::PushList(Index list, Runtime::Closure &closure) {
+  Index count = program_.lists[list];
+  for (Index i = 1; i <= count; ++i) {
+    arguments_.push_back(Execute(program_.lists[list + i], closure));
+  }
+}
+
+ObjectHolder Executor::Variable(Index node, Runtime::Closure &closure) {
+  const auto &[name, field, unused] = program_.operands[node];
+  auto it = closure.find(program_.names[name]);
+  if (it == closure.end()) {
+    throw runtime_error("No such variable!");
+  }
+  if (field == kNoIndex) {
+    return it->second;
+  }
+  ObjectHolder *value = field_caches_[field].Find(
+      Runtime::AsInstance(it->second), selectors_[field]);
+  return value ? *value : ObjectHolder::None();
+}
+
+ObjectHolder Executor::Execute(Index node, Runtime::Closure &closure) {
+  const auto &[a, b, c] = program_.operands[node];
+
+  switch (program_.kinds[node]) {
+    case Kind::kNumber:
+    case Kind::kString:
+    case Kind::kBool:
+      return program_.constants[a];
+    case Kind::kNone:
+      return ObjectHolder::None();
+    case Kind::kVariable:
+      return Variable(node, closure);
+    case Kind::kAssignment:
+      return Slot(closure, program_.names[a]) = Execute(b, closure);
+    case Kind::kFieldAssignment: {
+      ObjectHolder receiver = Variable(a, closure);
+      // The value first: computing it may add fields and move the others.
+      ObjectHolder value = Execute(c, closure);
+      ObjectHolder &field = field_caches_[b].Get(
+          Runtime::AsInstance(receiver), selectors_[b]);
+      return field = std::move(value);
+    }
+    case Kind::kPrint: {
+      ostream &output = Ast::Print::OutputStream();
+      Index count = program_.lists[a];
+      for (Index i = 1; i <= count; ++i) {
+        if (i > 1) {
+          output << ' ';
+        }
+        Runtime::PrintValue(Execute(program_.lists[a + i], closure), output);
+      }
+      output << '\n';
+      return ObjectHolder::None();
+    }
+    case Kind::kMethodCall: {
+      ArgumentScope args(arguments_);
+      PushList(c, closure);
+      ObjectHolder receiver = Variable(a, closure);
+      Runtime::ClassInstance &instance = Runtime::AsInstance(receiver);
+      const Runtime::Method *method =
+          instance.GetClass().GetMethod(selectors_[b]);
+      return instance.Call(
+          Runtime::CheckCall(method, selectors_[b], args.Values().size()),
+          args.Values());
+    }
+    case Kind::kNewInstance: {
+      const auto &cls = *classes_[a].TryAs<Runtime::Class>();
+      ObjectHolder holder = Runtime::ClassInstance::Create(cls);
+      auto *instance = holder.TryAs<Runtime::ClassInstance>();
+      auto *init = cls.GetOperator(Runtime::Operator::kInit);
+      if (init && init->formal_params.size() == program_.lists[b]) {
+        ArgumentScope args(arguments_);
+        PushList(b, closure);
+        instance->Call(*init, args.Values());
+      }
+      return holder;
+    }
+    case Kind::kStringify:
+      return Runtime::Stringify(Execute(a, closure));
+    case Kind::kAdd: {
+      auto lhs = Execute(a, closure);
+      return Runtime::Add(std::move(lhs), Execute(b, closure));
+    }
+    case Kind::kSub: {
+      auto lhs = Execute(a, closure);
+      return Runtime::Sub(std::move(lhs), Execute(b, closure));
+    }
+    case Kind::kMult: {
+      auto lhs = Execute(a, closure);
+      return Runtime::Mult(std::move(lhs), Execute(b, closure));
+    }
+    case Kind::kDiv: {
+      auto lhs = Execute(a, closure);
+      return Runtime::Div(std::move(lhs), Execute(b, closure));
+    }
+    case Kind::kOr: {
+      auto lhs = Execute(a, closure);
+      return Runtime::Or(lhs, Execute(b, closure));
+    }
+    case Kind::kAnd: {
+      auto lhs = Execute(a, closure);
+      return Runtime::And(lhs, Execute(b, closure));
+    }
+    case Kind::kNot:
+      return Runtime::Not(Execute(a, closure));
+    case Kind::kCompound:
+      return RunList(a, closure).value;
+    case Kind::kReturn:
+      return Execute(a, closure);
+    case Kind::kClassDefinition: {
+      const ObjectHolder &cls = classes_[a];
+      Slot(closure, cls.TryAs<Runtime::Class>()->GetName()) = cls;
+      return ObjectHolder::None();
+    }
+    case Kind::kIfElse:
+      return Run(node, closure).value;
+    case Kind::kComparison: {
+      auto lhs = Execute(a, closure);
+      return ObjectHolder::Own(Runtime::Bool(
+          Compare(static_cast<CompareOp>(c), std::move(lhs),
+                  Execute(b, closure))));
+    }
+  }
+  throw logic_error("Unknown node kind");
+}
+
+} /* namespace Flat */
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "inline_cache.h"
+#include "object_holder.h"
+#include "symbol_table.h"
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace Ast {
+class Program;
+class Arena;
+struct Completion;
+}
+
+namespace Flat {
+
+// Compact alternative to the Ast tree: nodes are rows of a table, children
+// are 32-bit row numbers, and payloads live in side pools.
+
+using Index = uint32_t;
+constexpr Index kNoIndex = std::numeric_limits<Index>::max();
+
+// Operands of each kind, in order (- means unused):
+//   kNumber, kString, kBool  constant
+//   kNone                    -
+//   kVariable                name, field name or kNoIndex
+//   kAssignment              name, value
+//   kFieldAssignment         kVariable node, field name, value
+//   kPrint                   list of arguments
+//   kMethodCall              kVariable node, method name, list of arguments
+//   kNewInstance             class, list of arguments
+//   kStringify, kNot         argument
+//   kAdd ... kAnd            lhs, rhs
+//   kCompound                list of statements
+//   kReturn                  value
+//   kClassDefinition         class
+//   kIfElse                  condition, if body, else body or kNoIndex
+//   kComparison              lhs, rhs, CompareOp
+enum class Kind : uint8_t {
+  kNumber,
+  kString,
+  kBool,
+  kNone,
+  kVariable,
+  kAssignment,
+  kFieldAssignment,
+  kPrint,
+  kMethodCall,
+  kNewInstance,
+  kStringify,
+  kAdd,
+  kSub,
+  kMult,
+  kDiv,
+  kOr,
+  kAnd,
+  kNot,
+  kCompound,
+  kReturn,
+  kClassDefinition,
+  kIfElse,
+  kComparison,
+};
+
+enum class CompareOp : Index {
+  kEqual,
+  kNotEqual,
+  kLess,
+  kGreater,
+  kLessOrEqual,
+  kGreaterOrEqual,
+};
+
+struct ClassEntry {
+  Index name;
+  Index parent;  // kNoIndex for a root class
+  Index first_method;
+  Index method_count;
+};
+
+struct MethodEntry {
+  Index name;
+  Index params;  // list of names
+  Index body;
+};
+
+struct Program {
+  std::vector<Kind> kinds;
+  std::vector<std::array<Index, 3>> operands;
+  // A list is a count followed by that many indices.
+  std::vector<Index> lists;
+  std::vector<std::string_view> names;
+  std::vector<ObjectHolder> constants;
+  std::vector<ClassEntry> classes;
+  std::vector<MethodEntry> methods;
+  Index root = kNoIndex;
+  // Keeps alive whatever names point into when they don't come from the
+  // symbol table, e.g. a mapped cache file.
+  std::shared_ptr<const void> storage;
+
+  size_t NodeCount() const {
+    return kinds.size();
+  }
+
+  // Bytes taken by the tables, not counting vector slack.
+  size_t MemoryUsage() const;
+};
+
+// Translates a parsed program. The result shares nothing with the tree (names
+// point into the symbol table), so the tree can be dropped.
+std::unique_ptr<Program> Lower(const Ast::Program &program);
+
+// Walks a flat program. Classes are rebuilt as Runtime::Class objects whose
+// method bodies run on this executor, so instances behave exactly as with the
+// tree walker. The executor must outlive the closures it runs in.
+class Executor {
+ public:
+  explicit Executor(const Program &program);
+  ~Executor();
+
+  ObjectHolder Execute(Runtime::Closure &closure);
+  // Used by method bodies.
+  ObjectHolder Execute(Index node, Runtime::Closure &closure);
+
+ private:
+  // Runs a statement of a block, or a block's list of statements, like
+  // Ast::ExecuteStatement and Ast::Compound::Run.
+  Ast::Completion Run(Index statement, Runtime::Closure &closure);
+  Ast::Completion RunList(Index list, Runtime::Closure &closure);
+  // Evaluates a list of arguments onto arguments_.
+  void PushList(Index list, Runtime::Closure &closure);
+  ObjectHolder Variable(Index node, Runtime::Closure &closure);
+
+  const Program &program_;
+  std::unique_ptr<Ast::Arena> bodies_;
+  std::vector<ObjectHolder> classes_;
+  // Interned program_.names, for method and field lookups.
+  std::vector<Runtime::Symbol> selectors_;
+  // Field access caches, one per name, shared by the sites using it.
+  std::vector<Runtime::FieldCache> field_caches_;
+  // Arguments of the calls in progress, innermost on top.
+  std::vector<ObjectHolder> arguments_;
+};
+
+} /* namespace Flat */
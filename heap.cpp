@@ -0,0 +1,131 @@
+#include "heap.h"
+#include "object.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace Runtime {
+
+namespace {
+// Rough footprint of an instance made by ClassInstance::Create: the object
+// with its shared_ptr control block, and the fields stored outside it.
+size_t Footprint(const ClassInstance &instance) {
+  constexpr size_t kControlBlock = sizeof(void *) + 2 * sizeof(int);
+  size_t fields = instance.GetShape().Size();
+  size_t more_fields = fields > ClassInstance::kInlineFields
+      ? fields - ClassInstance::kInlineFields : 0;
+  return sizeof(ClassInstance) + kControlBlock
+      + more_fields * sizeof(ObjectHolder);
+}
+}
+
+Heap &Heap::Local() {
+  thread_local Heap heap;
+  return heap;
+}
+
+Heap::~Heap() {
+  // Instances still alive when their thread ends are no longer tracked.
+  for (ClassInstance *instance : instances_) {
+    instance->heap_ = nullptr;
+  }
+}
+
+void Heap::Track(ClassInstance &instance) {
+  instance.heap_ = this;
+  instance.heap_index_ = instances_.size();
+  instances_.push_back(&instance);
+  stats_.live = instances_.size();
+  stats_.peak_live = max(stats_.peak_live, stats_.live);
+  if (++allocated_ > max(min_trigger_, survivors_)) {
+    Collect();
+  }
+}
+
+void Heap::Untrack(ClassInstance &instance) {
+  ClassInstance *last = instances_.back();
+  instances_[instance.heap_index_] = last;
+  last->heap_index_ = instance.heap_index_;
+  instances_.pop_back();
+  stats_.live = instances_.size();
+}
+
+void Heap::Collect() {
+  if (collecting_) {
+    return;
+  }
+  collecting_ = true;
+  auto start = chrono::steady_clock::now();
+
+  auto traced = [this](ObjectHolder &value) -> ClassInstance * {
+    auto *instance = value.TryAs<ClassInstance>();
+    return instance && instance->heap_ == this ? instance : nullptr;
+  };
+
+  // References to each instance from outside the heap: all of them, less
+  // those from fields of instances.
+  vector<long> outside(instances_.size());
+  for (size_t i = 0; i < instances_.size(); ++i) {
+    ClassInstance &instance = *instances_[i];
+    outside[i] += instance.self_.use_count();
+    for (size_t field = 0; field < instance.GetShape().Size(); ++field) {
+      if (ClassInstance *target = traced(instance.FieldAt(field))) {
+        --outside[target->heap_index_];
+      }
+    }
+  }
+
+  vector<bool> reachable(instances_.size());
+  vector<ClassInstance *> pending;
+  for (size_t i = 0; i < instances_.size(); ++i) {
+    if (outside[i] > 0) {
+      reachable[i] = true;
+      pending.push_back(instances_[i]);
+    }
+  }
+  while (!pending.empty()) {
+    ClassInstance *instance = pending.back();
+    pending.pop_back();
+    for (size_t field = 0; field < instance->GetShape().Size(); ++field) {
+      ClassInstance *target = traced(instance->FieldAt(field));
+      if (target && !reachable[target->heap_index_]) {
+        reachable[target->heap_index_] = true;
+        pending.push_back(target);
+      }
+    }
+  }
+
+  // Holding every garbage instance while their fields are cleared keeps
+  // them all from being freed, and so untracked, before the last one.
+  vector<ObjectHolder> garbage;
+  for (size_t i = 0; i < instances_.size(); ++i) {
+    if (!reachable[i]) {
+      garbage.push_back(instances_[i]->Self());
+    }
+  }
+  for (ObjectHolder &holder : garbage) {
+    ClassInstance &instance = *holder.TryAs<ClassInstance>();
+    for (size_t field = 0; field < instance.GetShape().Size(); ++field) {
+      instance.FieldAt(field) = ObjectHolder::None();
+    }
+  }
+  stats_.reclaimed += garbage.size();
+  garbage.clear();
+
+  allocated_ = 0;
+  survivors_ = instances_.size();
+  stats_.live_bytes = 0;
+  for (const ClassInstance *instance : instances_) {
+    stats_.live_bytes += Footprint(*instance);
+  }
+  auto pause = chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now() - start);
+  ++stats_.collections;
+  stats_.last_pause = pause;
+  stats_.max_pause = max(stats_.max_pause, pause);
+  stats_.total_pause += pause;
+  collecting_ = false;
+}
+
+} /* namespace Runtime */
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Runtime {
+
+class ClassInstance;
+
+struct HeapStats {
+  uint64_t collections = 0;
+  // Instances freed by collections: those only cycles kept alive.
+  uint64_t reclaimed = 0;
+  // Instances alive now, and the most there have been at once.
+  size_t live = 0;
+  size_t peak_live = 0;
+  // Rough size of the instances that survived the last collection, with
+  // their fields.
+  size_t live_bytes = 0;
+  std::chrono::nanoseconds last_pause{0};
+  std::chrono::nanoseconds max_pause{0};
+  std::chrono::nanoseconds total_pause{0};
+};
+
+// Keeps track of the class instances made on one thread and frees those kept
+// alive only by reference cycles among instances, which reference counting
+// alone never does.
+//
+// A collection needs no list of roots. An instance is referenced from
+// outside the heap (a closure, a frame, a temporary in the interpreter) when
+// its reference count exceeds the number of fields of other instances
+// pointing at it; everything reachable through fields from such an instance
+// is live, and the rest is garbage. So a collection is safe at any point,
+// which lets allocation start one: when the instances made since the last
+// collection outnumber both the minimum trigger and the survivors of that
+// collection.
+//
+// An instance must be released on the thread that made it.
+class Heap {
+ public:
+  static constexpr size_t kDefaultMinTrigger = 10000;
+
+  // The heap of the calling thread.
+  static Heap &Local();
+
+  Heap() = default;
+  ~Heap();
+
+  Heap(const Heap &) = delete;
+  Heap &operator=(const Heap &) = delete;
+
+  void Collect();
+
+  void SetMinTrigger(size_t instances) {
+    min_trigger_ = instances;
+  }
+
+  const HeapStats &Stats() const {
+    return stats_;
+  }
+
+ private:
+  friend class ClassInstance;
+
+  void Track(ClassInstance &instance);
+  void Untrack(ClassInstance &instance);
+
+  std::vector<ClassInstance *> instances_;
+  size_t allocated_ = 0;
+  size_t survivors_ = 0;
+  size_t min_trigger_ = kDefaultMinTrigger;
+  bool collecting_ = false;
+  HeapStats stats_;
+};
+
+} /* namespace Runtime */
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "object.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace Runtime {
+
+struct CacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+};
+
+// Method lookup cache of one call site: remembers what the last few receiver
+// classes resolved the site's selector to, so a call on a class seen before
+// costs a pointer comparison instead of a method table lookup. Once more
+// classes than it holds show up, the oldest entry is replaced. Entries are
+// never invalidated: a class must not get new methods after it has been
+// called through a cache.
+class InlineCache {
+ public:
+  static constexpr size_t kEntries = 4;
+
+  // The method of cls with that selector, or null if it has none.
+  const Method *Lookup(const Class &cls, Symbol selector, CacheStats &stats) {
+    for (size_t i = 0; i < size_; ++i) {
+      if (entries_[i].cls == &cls) {
+        ++stats.hits;
+        return entries_[i].method;
+      }
+    }
+    ++stats.misses;
+    const Method *method = cls.GetMethod(selector);
+    entries_[next_] = {&cls, method};
+    next_ = (next_ + 1) % kEntries;
+    if (size_ < kEntries) {
+      ++size_;
+    }
+    return method;
+  }
+
+ private:
+  struct Entry {
+    const Class *cls;
+    const Method *method;
+  };
+
+  std::array<Entry, kEntries> entries_{};
+  uint8_t size_ = 0;
+  uint8_t next_ = 0;
+};
+
+// Cache of one field access site: the shape the instances last seen there
+// had and the index of the field in it, and for a site that assigns a field
+// the instances lacked, the shape they had before. An instance of either
+// shape costs a pointer comparison instead of a search of its field names.
+// Shapes never change, so neither do the entries.
+class FieldCache {
+ public:
+  // The field of instance, or null if it has none.
+  ObjectHolder *Find(ClassInstance &instance, Symbol name) {
+    if (&instance.GetShape() != shape_) {
+      uint32_t index = instance.GetShape().IndexOf(name);
+      if (index == Shape::kMissing) {
+        return nullptr;
+      }
+      Remember(instance.GetShape(), nullptr, index);
+    }
+    return &instance.FieldAt(index_);
+  }
+
+  // The field of instance, added (as None) if it has none.
+  ObjectHolder &Get(ClassInstance &instance, Symbol name) {
+    const Shape &shape = instance.GetShape();
+    if (&shape == before_) {
+      instance.Reshape(*shape_);
+    } else if (&shape != shape_) {
+      uint32_t index = shape.IndexOf(name);
+      if (index == Shape::kMissing) {
+        const Shape &grown = shape.With(name);
+        instance.Reshape(grown);
+        Remember(grown, &shape, static_cast<uint32_t>(grown.Size() - 1));
+      } else {
+        Remember(shape, nullptr, index);
+      }
+    }
+    return instance.FieldAt(index_);
+  }
+
+ private:
+  void Remember(const Shape &shape, const Shape *before, uint32_t index) {
+    shape_ = &shape;
+    before_ = before;
+    index_ = index;
+  }
+
+  const Shape *shape_ = nullptr;
+  const Shape *before_ = nullptr;
+  uint32_t index_ = 0;
+};
+
+} /* namespace Runtime */
@@ -1,23 +1,167 @@
 #include "lexer.h"
+#include "scan.h"
+#include "source_buffer.h"
+#include "spsc_queue.h"
 
+#include <algorithm>
+#include <array>
 #include <charconv>
-#include <unordered_map>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
 namespace {
 using namespace Parse;
 
-std::unordered_map<std::string, Token> str_to_token{
+struct Keyword {
+  std::string_view text;
+  TokenView token;
+};
+
+constexpr std::array<Keyword, 13> kKeywords{{
     {"and", TokenType::And{}}, {"or", TokenType::Or{}},
     {"not", TokenType::Not{}}, {"None", TokenType::None{}},
     {"def", TokenType::Def{}}, {"class", TokenType::Class{}},
     {"print", TokenType::Print{}}, {"return", TokenType::Return{}},
     {"if", TokenType::If{}}, {"else", TokenType::Else{}},
     {"True", TokenType::True{}}, {"False", TokenType::False{}},
-    {">=", TokenType::GreaterOrEq{}}, {"<=", TokenType::LessOrEq{}},
-    {"==", TokenType::Eq{}}, {"!=", TokenType::NotEq{}}
+    {"import", TokenType::Import{}}
+}};
+
+// Perfect hash over kKeywords: the multipliers are picked at compile time so
+// that no two keywords share a bucket, and a lookup is one hash plus one
+// comparison.
+constexpr size_t kKeywordBuckets = 32;
+
+struct KeywordHash {
+  size_t length_mul;
+  size_t first_mul;
+
+  constexpr size_t operator()(std::string_view word) const {
+    return (word.size() * length_mul
+        + static_cast<unsigned char>(word.front()) * first_mul
+        + static_cast<unsigned char>(word.back())) % kKeywordBuckets;
+  }
 };
+
+constexpr bool IsPerfect(KeywordHash hash) {
+  std::array<bool, kKeywordBuckets> used{};
+  for (const auto &keyword : kKeywords) {
+    auto bucket = hash(keyword.text);
+    if (used[bucket]) {
+      return false;
+    }
+    used[bucket] = true;
+  }
+  return true;
+}
+
+constexpr KeywordHash FindKeywordHash() {
+  for (size_t length_mul = 1; length_mul < kKeywordBuckets; ++length_mul) {
+    for (size_t first_mul = 1; first_mul < kKeywordBuckets; ++first_mul) {
+      if (IsPerfect({length_mul, first_mul})) {
+        return {length_mul, first_mul};
+      }
+    }
+  }
+  return {0, 0};
+}
+
+constexpr KeywordHash kKeywordHash = FindKeywordHash();
+static_assert(kKeywordHash.length_mul != 0, "No perfect keyword hash found");
+
+constexpr auto kKeywordTable = [] {
+  std::array<const Keyword *, kKeywordBuckets> table{};
+  for (const auto &keyword : kKeywords) {
+    table[kKeywordHash(keyword.text)] = &keyword;
+  }
+  return table;
+}();
+
+const TokenView *FindKeyword(std::string_view word) {
+  const Keyword *keyword = kKeywordTable[kKeywordHash(word)];
+  if (keyword && keyword->text == word) {
+    return &keyword->token;
+  }
+  return nullptr;
+}
+
+// The Scan* helpers read one token starting at pos and advance pos past it.
+
+TokenView ScanNumber(const char *&pos, const char *end) {
+  int value = 0;
+  auto [number_end, ec] = std::from_chars(pos, end, value);
+  if (ec != std::errc()) {
+    throw LexerError("Bad number literal");
+  }
+  pos = number_end;
+  return TokenType::Number{value};
+}
+
+// First ' or " in [pos, end), or end.
+const char *FindQuote(const char *pos, const char *end) {
+  auto single = static_cast<const char *>(std::memchr(pos, '\'', end - pos));
+  auto double_ = static_cast<const char *>(std::memchr(pos, '"', end - pos));
+  if (!single) {
+    return double_ ? double_ : end;
+  }
+  return double_ ? std::min(single, double_) : single;
+}
+
+TokenView ScanString(const char *&pos, const char *end) {
+  char c = *pos;
+  if (c == '\'' || c == '\"') {
+    const char *begin = ++pos;
+    pos = Scan::FindChar(pos, end, c);
+    if (pos == end) {
+      throw LexerError("Unterminated string literal");
+    }
+    return TokenType::StringRef{std::string_view(begin, pos++ - begin)};
+  }
+
+  const char *begin = pos;
+  pos = Scan::SkipIdentifier(pos, end);
+  std::string_view str(begin, pos - begin);
+  if (const TokenView *keyword = FindKeyword(str)) {
+    return *keyword;
+  }
+  return TokenType::IdRef{str, Runtime::Intern(str)};
+}
+
+TokenView ScanChar(const char *&pos, const char *end) {
+  char c = *pos++;
+  if ((c == '!' || c == '=' || c == '>' || c == '<') && pos != end
+      && *pos == '=') {
+    ++pos;
+    switch (c) {
+      case '=':
+        return TokenType::Eq{};
+      case '!':
+        return TokenType::NotEq{};
+      case '<':
+        return TokenType::LessOrEq{};
+      default:
+        return TokenType::GreaterOrEq{};
+    }
+  }
+  return TokenType::Char{c};
+}
+
+TokenView ScanToken(const char *&pos, const char *end) {
+  char c = *pos;
+  if (isdigit(static_cast<unsigned char>(c))) {
+    return ScanNumber(pos, end);
+  } else if (isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '\"'
+      || c == '\'') {
+    return ScanString(pos, end);
+  } else {
+    return ScanChar(pos, end);
+  }
+}
 }
 
 namespace Parse {
@@ -76,6 +220,7 @@ std::ostream &operator<<(std::ostream &os, const Token &rhs) {
   UNVALUED_OUTPUT(None);
   UNVALUED_OUTPUT(True);
   UNVALUED_OUTPUT(False);
+  UNVALUED_OUTPUT(Import);
   UNVALUED_OUTPUT(Eof);
 
 #undef UNVALUED_OUTPUT
@@ -83,148 +228,375 @@ std::ostream &operator<<(std::ostream &os, const Token &rhs) {
   return os << "Unknown token :(";
 }
 
-Lexer::Lexer(std::istream &input) : in_(input) {
-  while (isspace(in_.peek())) in_.ignore();
-  NextToken();
+Token ToOwned(const TokenView &view) {
+  return std::visit([](const auto &alternative) -> Token {
+    using T = std::decay_t<decltype(alternative)>;
+    if constexpr (std::is_same_v<T, TokenType::IdRef>) {
+      return TokenType::Id{std::string(alternative.value), alternative.symbol};
+    } else if constexpr (std::is_same_v<T, TokenType::StringRef>) {
+      return TokenType::String{std::string(alternative.value)};
+    } else {
+      return alternative;
+    }
+  }, static_cast<const TokenViewBase &>(view));
+}
+
+// Producer side of a pipelined Lexer: a plain Lexer on its own thread. Tokens
+// cross over as TokenViews into the shared buffer, so an identifier or string
+// costs the same few words in the queue whatever its length.
+class Lexer::Pipeline {
+ public:
+  explicit Pipeline(std::shared_ptr<const SourceBuffer> source)
+      : thread_([this, source = std::move(source)]() mutable {
+          Produce(std::move(source));
+        }) {
+  }
+
+  ~Pipeline() {
+    queue_.Close();
+    thread_.join();
+  }
+
+  // Eof repeats at the end; an error repeats once reached.
+  TokenView Next() {
+    if (!failed_) {
+      if (at_eof_) {
+        return TokenType::Eof{};
+      }
+      TokenView token = queue_.Pop();
+      at_eof_ = token.Is<TokenType::Eof>();
+      if (!token.Is<std::monostate>()) {
+        return token;
+      }
+      failed_ = true;
+    }
+    std::rethrow_exception(error_);
+  }
+
+ private:
+  static constexpr size_t kCapacity = 1024;
+  static constexpr size_t kBatch = 64;
+
+  void Produce(std::shared_ptr<const SourceBuffer> source) {
+    try {
+      Lexer lexer(std::move(source));
+      for (size_t count = 1;; ++count) {
+        const TokenView &token = lexer.CurrentView();
+        if (!queue_.Push(token) || token.Is<TokenType::Eof>()) {
+          break;
+        }
+        if (count % kBatch == 0) {
+          queue_.Publish();
+        }
+        lexer.NextView();
+      }
+    } catch (...) {
+      // Published after error_ is set; the empty token stands for the error.
+      error_ = std::current_exception();
+      queue_.Push(TokenView{});
+    }
+    queue_.Publish();
+  }
+
+  SpscQueue<TokenView, kCapacity> queue_;
+  std::exception_ptr error_;
+  bool at_eof_ = false;
+  bool failed_ = false;
+  // Last, so that it starts once everything else is initialized.
+  std::thread thread_;
+};
+
+Lexer::Lexer(std::istream &input) : Lexer(SourceBuffer::FromStream(input)) {
+}
+
+Lexer::Lexer(std::shared_ptr<const SourceBuffer> source)
+    : Lexer(source->Text()) {
+  source_ = std::move(source);
+}
+
+Lexer::Lexer(std::string_view source)
+    : pos_(source.data()), end_(source.data() + source.size()) {
+  pos_ = Scan::SkipWhitespace(pos_, end_);
+  NextView();
+}
+
+Lexer::Lexer(std::string_view block, int indent_level)
+    : prev_indent_count(indent_level), curr_indent_count(indent_level),
+      pos_(block.data()), end_(block.data() + block.size()),
+      current_(TokenType::Newline{}) {
+}
+
+Lexer::Lexer(std::shared_ptr<const SourceBuffer> source, Pipelined)
+    : source_(source), pipeline_(std::make_unique<Pipeline>(std::move(source))) {
+  NextView();
+}
+
+Lexer::~Lexer() = default;
+
+std::string_view Lexer::PeekIndentedBlock() const {
+  if (pipeline_) {
+    return {};
+  }
+  if (!current_.Is<TokenType::Newline>() || !need_to_check) {
+    throw LexerError("Indented block must follow a line break");
+  }
+
+  const char *block_end = pos_;
+  for (const char *pos = pos_; pos != end_;) {
+    const char *first = Scan::SkipSpaces(pos, end_);
+    if (first == end_ || *first == '\n') {
+      pos = first == end_ ? end_ : first + 1;
+      continue;
+    }
+    if ((first - pos) / 2 <= prev_indent_count) {
+      break;
+    }
+    // String literals may span lines; what's inside them isn't indentation.
+    for (pos = first; pos != end_;) {
+      const char *line_end = Scan::FindChar(pos, end_, '\n');
+      const char *quote = FindQuote(pos, line_end);
+      if (quote == line_end) {
+        pos = line_end == end_ ? end_ : line_end + 1;
+        break;
+      }
+      pos = Scan::FindChar(quote + 1, end_, *quote);
+      if (pos != end_) {
+        ++pos;
+      }
+    }
+    block_end = pos;
+  }
+
+  return {pos_, static_cast<size_t>(block_end - pos_)};
+}
+
+std::string_view Lexer::SkipIndentedBlock() {
+  std::string_view block = PeekIndentedBlock();
+  pos_ += block.size();
+  return block;
 }
 
 const Token &Lexer::CurrentToken() const {
+  if (token_stale_) {
+    current_token_ = ToOwned(current_);
+    token_stale_ = false;
+  }
   return current_token_;
 }
 
-Token Lexer::NextToken() {
-  return ReadToken();
+const Token &Lexer::NextToken() {
+  NextView();
+  return CurrentToken();
 }
 
-Token Lexer::ReadToken() {
-  if (need_to_check)
-    CountIndents();
-  if (auto opt = ReadIndentOrDedent()) {
-    return *opt;
+const TokenView &Lexer::CurrentView() const {
+  return current_;
+}
+
+const TokenView &Lexer::NextView() {
+  if (pipeline_) {
+    current_ = pipeline_->Next();
+  } else {
+    ReadToken();
   }
+  token_stale_ = true;
+  return current_;
+}
 
-  if ((in_.eof() || in_.peek() == char_traits<char>::eof())) {
-    if (current_token_.Is<TokenType::Newline>() ||
-        current_token_.Is<TokenType::Eof>() ||
-        current_token_.Is<TokenType::Dedent>()) {
-      return current_token_ = TokenType::Eof{};
-    }
-    return current_token_ = TokenType::Newline{};
+void Lexer::ReadToken() {
+  if (need_to_check)
+    CountIndents();
+  if (ReadIndentOrDedent()) {
+    return;
   }
 
-  char c = in_.peek();
-  if (c == '\n') {
+  if (!AtEnd() && Peek() == '\n') {
     ReadNewLine();
-    return current_token_;
+    return;
   }
   Trim();
-  c = in_.peek();
-  if (isdigit(c)) {
-    ReadNumber();
-  } else if (isalpha(c) || c == '_' || c == '\"' || c == '\'') {
-    ReadString();
-  } else {
-    ReadChar();
+
+  if (AtEnd()) {
+    if (current_.Is<TokenType::Newline>() ||
+        current_.Is<TokenType::Eof>() ||
+        current_.Is<TokenType::Dedent>()) {
+      current_ = TokenType::Eof{};
+    } else {
+      current_ = TokenType::Newline{};
+    }
+    return;
   }
-  return current_token_;
+
+  current_ = ScanToken(pos_, end_);
 }
 
-Token Lexer::ReadNewLine() {
-  in_.ignore();
+void Lexer::ReadNewLine() {
+  ++pos_;
   need_to_check = true;
-  return current_token_ = TokenType::Newline{};
+  current_ = TokenType::Newline{};
 }
 
 void Lexer::CountIndents() {
   int count = 0;
 
-  while (in_.peek() == ' ' && !in_.eof()) {
-    in_.get();
-    ++count;
-  }
-  if (in_.peek() == '\n') {
-    in_.ignore();
-    CountIndents();
-  } else {
-    curr_indent_count = count / 2;
-    need_to_check = false;
+  while (true) {
+    const char *line_start = pos_;
+    pos_ = Scan::SkipSpaces(pos_, end_);
+    if (!AtEnd() && *pos_ == '\n') {
+      ++pos_;
+      continue;
+    }
+    count = static_cast<int>(pos_ - line_start);
+    break;
   }
+  curr_indent_count = count / 2;
+  need_to_check = false;
 }
 
-std::optional<Token> Lexer::ReadIndentOrDedent() {
+bool Lexer::ReadIndentOrDedent() {
   if (prev_indent_count > curr_indent_count) {
     --prev_indent_count;
-    return current_token_ = TokenType::Dedent{};
+    current_ = TokenType::Dedent{};
+    return true;
   } else if (prev_indent_count < curr_indent_count) {
     ++prev_indent_count;
-    return current_token_ = TokenType::Indent{};
-  }
-  return std::nullopt;
-};
-
-Token Lexer::ReadNumber() {
-  std::string num;
-  while (isdigit(in_.peek()) && !in_.eof()) {
-    num.push_back(in_.get());
+    current_ = TokenType::Indent{};
+    return true;
   }
-  return current_token_ = TokenType::Number{std::stoi(num)};
+  return false;
 }
 
-Token Lexer::ReadString() {
-  char c = in_.peek();
-  if (c == '\'' || c == '\"') {
-    in_.ignore();
-    std::string str;
-    while (in_.peek() != c) {
-      str.push_back(in_.get());
-    }
-    in_.ignore();
-
-    return current_token_ = TokenType::String{std::move(str)};
-  }
+void Lexer::Trim() {
+  pos_ = Scan::SkipWhitespace(pos_, end_);
+}
 
-  std::string str;
-  while ((isalnum(in_.peek()) || in_.peek() == '_') && !in_.eof()) {
-    str.push_back(in_.get());
+void IncrementalLexer::Feed(std::string_view chunk) {
+  if (finished_) {
+    throw LexerError("Input fed after Finish()");
   }
-  if (auto found = str_to_token.find(str); found != str_to_token.end()) {
-    current_token_ = found->second;
-  } else {
-    current_token_ = TokenType::Id{str};
+  // Drop lexed bytes once they dominate the buffer, so it stays
+  // proportional to the text not lexed yet.
+  if (head_ > 0 && head_ * 2 >= buffer_.size()) {
+    buffer_.erase(0, head_);
+    scan_from_ -= head_;
+    complete_ -= head_;
+    lexed_ -= head_;
+    head_ = 0;
   }
+  buffer_.append(chunk);
+}
 
-  return current_token_;
+void IncrementalLexer::Finish() {
+  finished_ = true;
 }
 
-Token Lexer::ReadChar() {
-  char c = in_.get();
-  if ((c == '!' || c == '=' || c == '>' || c == '<') && !in_.eof()) {
-    if (auto opt = ReadComplexChar(c)) {
-      return *opt;
+std::optional<Token> IncrementalLexer::NextToken() {
+  while (pending_.empty()) {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    if (eof_) {
+      return TokenType::Eof{};
+    }
+
+    if (!started_) {
+      const char *begin = buffer_.data();
+      head_ = Scan::SkipWhitespace(begin + head_, begin + buffer_.size())
+          - begin;
+      scan_from_ = std::max(scan_from_, head_);
+      complete_ = std::max(complete_, head_);
+      lexed_ = std::max(lexed_, head_);
+      if (head_ == buffer_.size()) {
+        if (!finished_) {
+          return std::nullopt;
+        }
+        // What Lexer makes of blank text.
+        pending_.push_back(TokenType::Newline{});
+        pending_.push_back(TokenType::Eof{});
+        eof_ = true;
+        break;
+      }
+      started_ = true;
+    }
+
+    if (finished_) {
+      Lex(buffer_.size());
+      continue;
+    }
+    ScanLines();
+    if (complete_ == lexed_) {
+      return std::nullopt;
     }
+    Lex(complete_);
   }
-  return current_token_ = TokenType::Char{c};
 
+  Token token = std::move(pending_.front());
+  pending_.pop_front();
+  return token;
 }
 
-std::optional<Token> Lexer::ReadComplexChar(char c) {
-  std::string complex;
-  complex.push_back(c);
-
-  char next = in_.peek();
-  if (next == '=') {
-    complex.push_back(in_.get());
+void IncrementalLexer::Lex(size_t end) {
+  lexed_ = end;
+  std::string_view text(buffer_.data() + head_, end - head_);
+  // Tokens after the last final one.
+  std::vector<Token> tokens;
+  try {
+    Lexer lexer(text, indent_);
+    while (true) {
+      const char *before = lexer.pos_;
+      const TokenView &token = lexer.NextView();
+      tokens.push_back(ToOwned(token));
+      if (token.Is<TokenType::Eof>()) {
+        break;
+      }
+      // A Newline read at a line break, rather than made up at the end of
+      // the text: what follows can't change it or anything before it.
+      if (token.Is<TokenType::Newline>() && before != lexer.end_
+          && *before == '\n') {
+        std::move(tokens.begin(), tokens.end(), std::back_inserter(pending_));
+        tokens.clear();
+        head_ = lexer.pos_ - buffer_.data();
+        indent_ = lexer.IndentLevel();
+      }
+    }
+  } catch (const LexerError &) {
+    // The text up to the error is complete, so Lexer would fail there too,
+    // after the tokens before it.
+    error_ = std::current_exception();
   }
-
-  if (complex.size() == 1) {
-    return std::nullopt;
+  if (finished_ || error_) {
+    std::move(tokens.begin(), tokens.end(), std::back_inserter(pending_));
+    eof_ = !error_;
   }
-  return current_token_ = str_to_token[complex];
 }
 
-void Lexer::Trim() {
-  while (isspace(in_.peek())) {
-    in_.ignore();
+void IncrementalLexer::ScanLines() {
+  const char *begin = buffer_.data();
+  const char *end = begin + buffer_.size();
+  const char *pos = begin + scan_from_;
+  while (pos != end) {
+    if (quote_) {
+      pos = Scan::FindChar(pos, end, quote_);
+      if (pos == end) {
+        break;
+      }
+      quote_ = 0;
+      ++pos;
+      continue;
+    }
+    const char *line_end = Scan::FindChar(pos, end, '\n');
+    const char *quote = FindQuote(pos, line_end);
+    if (quote != line_end) {
+      quote_ = *quote;
+      pos = quote + 1;
+    } else if (line_end != end) {
+      pos = line_end + 1;
+      complete_ = pos - begin;
+    } else {
+      pos = end;
+    }
   }
+  scan_from_ = pos - begin;
 }
+
 } /* namespace Parse */
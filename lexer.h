@@ -2,16 +2,22 @@
 #define MYTHON_LEXER_LEXER_H_
 
 #include <cctype>
+#include <deque>
 #include <exception>
 #include <iosfwd>
 #include <iostream>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <variant>
 
+#include "symbol_table.h"
+
 class TestRunner;
 
 namespace Parse {
@@ -23,6 +29,7 @@ struct Number {
 
 struct Id {
   std::string value;
+  Runtime::Symbol symbol = Runtime::kNoSymbol;
 };
 
 struct Char {
@@ -33,6 +40,17 @@ struct String {
   std::string value;
 };
 
+// Non-owning counterparts of Id and String: the payload points into the
+// source buffer the lexer scans.
+struct IdRef {
+  std::string_view value;
+  Runtime::Symbol symbol = Runtime::kNoSymbol;
+};
+
+struct StringRef {
+  std::string_view value;
+};
+
 struct Class {};
 struct Return {};
 struct If {};
@@ -53,6 +71,7 @@ struct GreaterOrEq {};
 struct None {};
 struct True {};
 struct False {};
+struct Import {};
 }
 
 using TokenBase = std::variant<
@@ -80,11 +99,44 @@ using TokenBase = std::variant<
     TokenType::None,
     TokenType::True,
     TokenType::False,
+    TokenType::Import,
     TokenType::Eof
 >;
 
-struct Token : TokenBase {
-  using TokenBase::TokenBase;
+// Same alternatives in the same order as TokenBase, with Id and String
+// replaced by their non-owning counterparts.
+using TokenViewBase = std::variant<
+    std::monostate,
+    TokenType::Number,
+    TokenType::IdRef,
+    TokenType::Char,
+    TokenType::StringRef,
+    TokenType::Class,
+    TokenType::Return,
+    TokenType::If,
+    TokenType::Else,
+    TokenType::Def,
+    TokenType::Newline,
+    TokenType::Print,
+    TokenType::Indent,
+    TokenType::Dedent,
+    TokenType::And,
+    TokenType::Or,
+    TokenType::Not,
+    TokenType::Eq,
+    TokenType::NotEq,
+    TokenType::LessOrEq,
+    TokenType::GreaterOrEq,
+    TokenType::None,
+    TokenType::True,
+    TokenType::False,
+    TokenType::Import,
+    TokenType::Eof
+>;
+
+template<typename Base>
+struct BasicToken : Base {
+  using Base::Base;
 
   template<typename T>
   bool Is() const {
@@ -102,6 +154,16 @@ struct Token : TokenBase {
   }
 };
 
+struct Token : BasicToken<TokenBase> {
+  using BasicToken::BasicToken;
+};
+
+struct TokenView : BasicToken<TokenViewBase> {
+  using BasicToken::BasicToken;
+};
+
+Token ToOwned(const TokenView &view);
+
 bool operator==(const Token &lhs, const Token &rhs);
 std::ostream &operator<<(std::ostream &os, const Token &rhs);
 
@@ -110,64 +172,173 @@ class LexerError : public std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
+class SourceBuffer;
+
+// Selects the Lexer constructor that scans on a separate thread.
+struct Pipelined {};
+inline constexpr Pipelined kPipelined;
+
+// Scans a contiguous buffer in place. Id and String tokens are available both
+// as owning Token (materialized on demand) and as TokenView pointing into the
+// buffer; the latter stays valid as long as the buffer does.
 class Lexer {
  public:
+  // Reads the whole stream into a buffer owned by the lexer.
   explicit Lexer(std::istream &input);
+  explicit Lexer(std::shared_ptr<const SourceBuffer> source);
+  // The caller keeps the text alive for as long as the lexer and its token
+  // views are used.
+  explicit Lexer(std::string_view source);
+  // Lexes a block cut out with SkipIndentedBlock as if it still followed the
+  // Newline it came after, at the given indentation level.
+  Lexer(std::string_view block, int indent_level);
+  // Scans the buffer on a separate thread that stays up to a queue's worth of
+  // tokens ahead of the reader. Produces the same tokens as Lexer(source); a
+  // LexerError is thrown when the reader gets to it. Blocks can't be skipped
+  // (PeekIndentedBlock is always empty), so a lazy parse parses every body.
+  Lexer(std::shared_ptr<const SourceBuffer> source, Pipelined);
+  ~Lexer();
 
   const Token &CurrentToken() const;
-  Token NextToken();
+  const Token &NextToken();
+
+  const TokenView &CurrentView() const;
+  const TokenView &NextView();
 
   template<typename T>
   const T &Expect() const {
-    if (!CurrentToken().Is<T>()) {
-      throw LexerError("Unexpected token");
+    if constexpr (IsViewAlternative<T>::value) {
+      if (!current_.Is<T>()) {
+        throw LexerError("Unexpected token");
+      }
+      return current_.As<T>();
+    } else {
+      if (!CurrentToken().Is<T>()) {
+        throw LexerError("Unexpected token");
+      }
+      return CurrentToken().As<T>();
     }
-    return CurrentToken().As<T>();
   }
 
   template<typename T, typename U>
   void Expect(const U &value) const {
-    if (!CurrentToken().Is<T>() || CurrentToken().As<T>().value != value) {
+    if (Expect<T>().value != value) {
       throw LexerError("Unexpected token");
     }
   }
 
   template<typename T>
   const T &ExpectNext() {
-    NextToken();
+    NextView();
     return Expect<T>();
   }
 
   template<typename T, typename U>
   void ExpectNext(const U &value) {
-    NextToken();
+    NextView();
     Expect<T>(value);
   }
 
+  // Called on a Newline token: the lines after it that are blank or indented
+  // deeper than the current level, found without lexing them. The text is
+  // empty if the next line isn't indented deeper, and for a pipelined lexer.
+  std::string_view PeekIndentedBlock() const;
+  // Same, and lexing resumes after the block as if its tokens had been read.
+  std::string_view SkipIndentedBlock();
+  int IndentLevel() const {
+    return prev_indent_count;
+  }
+
+  // The buffer the lexer owns or shares; null if it was given a plain view.
+  const std::shared_ptr<const SourceBuffer> &Source() const {
+    return source_;
+  }
+
  private:
-  Token ReadToken();
+  template<typename T, typename Variant = TokenViewBase>
+  struct IsViewAlternative;
 
-  Token ReadNewLine();
+  template<typename T, typename... Ts>
+  struct IsViewAlternative<T, std::variant<Ts...>>
+      : std::disjunction<std::is_same<T, Ts>...> {
+  };
 
-  void CountIndents();
+  bool AtEnd() const {
+    return pos_ == end_;
+  }
 
-  std::optional<Token> ReadIndentOrDedent();
+  char Peek() const {
+    return AtEnd() ? '\0' : *pos_;
+  }
 
-  Token ReadNumber();
+  void ReadToken();
 
-  Token ReadString();
+  void ReadNewLine();
 
-  Token ReadChar();
+  void CountIndents();
 
-  std::optional<Token> ReadComplexChar(char c);
+  bool ReadIndentOrDedent();
 
   void Trim();
 
   int prev_indent_count = 0;
   int curr_indent_count = 0;
-  std::istream &in_;
-  Token current_token_;
+  std::shared_ptr<const SourceBuffer> source_;
+  const char *pos_ = nullptr;
+  const char *end_ = nullptr;
+  TokenView current_;
+  mutable Token current_token_;
+  mutable bool token_stale_ = true;
   bool need_to_check = true;
+
+  class Pipeline;
+  std::unique_ptr<Pipeline> pipeline_;
+
+  friend class IncrementalLexer;
+};
+
+// Lexer for text that arrives in chunks. Tokens come out once the lines they
+// are on are complete: a line break outside a string literal ends a line, and
+// the tokens before a Newline read at such a break are final. Each time,
+// Lexer goes over the complete lines after the last of those Newlines, so the
+// token stream is the one Lexer produces for the concatenated input, and a
+// LexerError is thrown when the reader gets to it.
+class IncrementalLexer {
+ public:
+  void Feed(std::string_view chunk);
+  // No more input: the rest is lexed and the stream is closed with Newline,
+  // Dedents and Eof the way Lexer closes it.
+  void Finish();
+
+  // The next token, or nullopt if more input is needed. After Eof keeps
+  // returning Eof.
+  std::optional<Token> NextToken();
+
+ private:
+  // Lexes buffer_ from head_ up to end, queueing the tokens that are final.
+  void Lex(size_t end);
+  // Finds the line breaks outside string literals fed since the last call.
+  void ScanLines();
+
+  std::string buffer_;
+  // Bytes before head_ have been lexed into final tokens; lexing resumes
+  // there at indentation level indent_, as after a Newline.
+  size_t head_ = 0;
+  int indent_ = 0;
+  // Bytes before scan_from_ have been scanned for line breaks: complete_
+  // is past the last one outside a string, and quote_ is the quote of the
+  // string literal still open, or 0.
+  size_t scan_from_ = 0;
+  size_t complete_ = 0;
+  char quote_ = 0;
+  // End of the text last lexed, so that it isn't lexed again for nothing.
+  size_t lexed_ = 0;
+  std::deque<Token> pending_;
+  std::exception_ptr error_;
+  // Set once the leading whitespace of the input, which Lexer skips, is past.
+  bool started_ = false;
+  bool finished_ = false;
+  bool eof_ = false;
 };
 
 void RunLexerTests(TestRunner &test_runner);
@@ -0,0 +1,215 @@
+#include "module_loader.h"
+#include "lexer.h"
+#include "object.h"
+#include "parse.h"
+#include "source_buffer.h"
+#include "statement.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+namespace Parse {
+
+namespace {
+
+struct Node {
+  unique_ptr<Module> module;
+  vector<string> import_names;
+  vector<Node *> imports;
+  vector<Node *> dependents;
+  atomic<size_t> pending_imports = 0;
+  enum class Mark { kNone, kVisiting, kDone } mark = Mark::kNone;
+};
+
+// Lists nodes so that imports come before their importers; throws on cycles.
+void Order(Node &node, vector<Node *> &order, vector<const Node *> &path) {
+  if (node.mark == Node::Mark::kDone) {
+    return;
+  }
+  if (node.mark == Node::Mark::kVisiting) {
+    string cycle;
+    auto start = find(path.begin(), path.end(), &node);
+    for (auto it = start; it != path.end(); ++it) {
+      cycle += (*it)->module->name + " -> ";
+    }
+    throw ParseError("Import cycle: " + cycle + node.module->name);
+  }
+
+  node.mark = Node::Mark::kVisiting;
+  path.push_back(&node);
+  for (Node *import : node.imports) {
+    Order(*import, order, path);
+  }
+  path.pop_back();
+  node.mark = Node::Mark::kDone;
+  order.push_back(&node);
+}
+
+void ParseModule(Node &node) {
+  Module &module = *node.module;
+  for (const Module *import : module.imports) {
+    for (const auto &[name, cls] : import->visible_classes) {
+      auto [it, inserted] = module.visible_classes.emplace(name, cls);
+      if (!inserted && it->second.Get() != cls.Get()) {
+        throw ParseError(module.path + ": class " + name
+                             + " is defined by more than one imported module");
+      }
+    }
+  }
+
+  try {
+    Lexer lexer(module.source);
+    module.program = ParseProgram(lexer, module.visible_classes);
+  } catch (const runtime_error &e) {
+    throw ParseError(module.path + ": " + e.what());
+  }
+
+  for (const ObjectHolder &cls : module.program->Classes()) {
+    module.visible_classes.emplace(
+        cls.TryAs<Runtime::Class>()->GetName(), cls);
+  }
+}
+
+} /* namespace */
+
+LinkedProgram::LinkedProgram(vector<unique_ptr<Module>> modules)
+    : modules_(std::move(modules)) {
+}
+
+LinkedProgram::~LinkedProgram() = default;
+
+ObjectHolder LinkedProgram::Execute(Runtime::Closure &closure) {
+  ObjectHolder result;
+  for (const auto &module : modules_) {
+    result = module->program->Execute(closure);
+  }
+  return result;
+}
+
+ModuleLoader::ModuleLoader(vector<string> search_path, size_t threads)
+    : search_path_(std::move(search_path)), threads_(threads) {
+}
+
+string ModuleLoader::Resolve(const string &name,
+                             const vector<string> &directories) const {
+  filesystem::path relative;
+  size_t start = 0;
+  for (size_t dot; (dot = name.find('.', start)) != string::npos;
+       start = dot + 1) {
+    relative /= name.substr(start, dot - start);
+  }
+  relative /= name.substr(start) + ".my";
+
+  for (const string &directory : directories) {
+    auto candidate = filesystem::path(directory) / relative;
+    if (filesystem::is_regular_file(candidate)) {
+      return filesystem::weakly_canonical(candidate).string();
+    }
+  }
+  throw ParseError("Module " + name + " not found");
+}
+
+unique_ptr<LinkedProgram> ModuleLoader::Load(const string &main_path) const {
+  filesystem::path main_directory = filesystem::path(main_path).parent_path();
+  vector<string> directories{
+      main_directory.empty() ? string(".") : main_directory.string()};
+  directories.insert(directories.end(), search_path_.begin(),
+                     search_path_.end());
+
+  ThreadPool pool(threads_);
+  mutex nodes_mutex;
+  // Keyed by module name; the main module can't be imported by name.
+  unordered_map<string, unique_ptr<Node>> nodes;
+
+  // Maps every reachable file and reads its import statements.
+  function<void(Node &)> discover = [&](Node &node) {
+    Module &module = *node.module;
+    module.source = SourceBuffer::MapFile(module.path);
+    try {
+      Lexer lexer(module.source);
+      node.import_names = ParseImports(lexer);
+    } catch (const runtime_error &e) {
+      throw ParseError(module.path + ": " + e.what());
+    }
+
+    for (const string &name : node.import_names) {
+      {
+        lock_guard lock(nodes_mutex);
+        if (nodes.count(name)) {
+          continue;
+        }
+      }
+      auto import = make_unique<Node>();
+      import->module = make_unique<Module>();
+      import->module->name = name;
+      import->module->path = Resolve(name, directories);
+
+      lock_guard lock(nodes_mutex);
+      auto [it, inserted] = nodes.emplace(name, std::move(import));
+      if (inserted) {
+        Node *created = it->second.get();
+        pool.Submit([&discover, created] { discover(*created); });
+      }
+    }
+  };
+
+  Node main;
+  main.module = make_unique<Module>();
+  main.module->name = filesystem::path(main_path).stem().string();
+  main.module->path = main_path;
+  pool.Submit([&] { discover(main); });
+  pool.Wait();
+
+  auto link = [&nodes](Node &node) {
+    for (const string &name : node.import_names) {
+      Node *import = nodes.at(name).get();
+      if (find(node.imports.begin(), node.imports.end(), import)
+          == node.imports.end()) {
+        node.imports.push_back(import);
+        node.module->imports.push_back(import->module.get());
+        import->dependents.push_back(&node);
+      }
+    }
+    node.pending_imports = node.imports.size();
+  };
+  link(main);
+  for (auto &[name, node] : nodes) {
+    link(*node);
+  }
+
+  vector<Node *> order;
+  vector<const Node *> path;
+  Order(main, order, path);
+
+  // Dependency-driven parse: each finished module releases the importers
+  // that were only waiting for it.
+  function<void(Node &)> parse = [&](Node &node) {
+    ParseModule(node);
+    for (Node *dependent : node.dependents) {
+      if (--dependent->pending_imports == 0) {
+        pool.Submit([&parse, dependent] { parse(*dependent); });
+      }
+    }
+  };
+  for (Node *node : order) {
+    if (node->imports.empty()) {
+      pool.Submit([&parse, node] { parse(*node); });
+    }
+  }
+  pool.Wait();
+
+  vector<unique_ptr<Module>> modules;
+  modules.reserve(order.size());
+  for (Node *node : order) {
+    modules.push_back(std::move(node->module));
+  }
+  return make_unique<LinkedProgram>(std::move(modules));
+}
+
+} /* namespace Parse */
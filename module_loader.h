@@ -0,0 +1,74 @@
+#pragma once
+
+#include "object_holder.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Ast {
+class Program;
+}
+
+namespace Parse {
+
+class SourceBuffer;
+
+// One source file of a program. `import a.b` refers to the module in a/b.my.
+struct Module {
+  // As written in the import statement; the main module is named after its
+  // file.
+  std::string name;
+  std::string path;
+  std::shared_ptr<const SourceBuffer> source;
+  std::vector<const Module *> imports;
+  std::unique_ptr<Ast::Program> program;
+  // Classes of this module and of everything it imports, directly or not.
+  Runtime::Closure visible_classes;
+};
+
+// A program together with every module it imports.
+class LinkedProgram {
+ public:
+  explicit LinkedProgram(std::vector<std::unique_ptr<Module>> modules);
+  ~LinkedProgram();
+
+  // Imports come before the modules importing them; the main module is last.
+  const std::vector<std::unique_ptr<Module>> &Modules() const {
+    return modules_;
+  }
+
+  // Runs the top level of each module once, in order, in the same closure,
+  // as if the files had been concatenated.
+  ObjectHolder Execute(Runtime::Closure &closure);
+
+ private:
+  std::vector<std::unique_ptr<Module>> modules_;
+};
+
+// Loads a program split across files. Imports must come before any other
+// statement of a module. All files are lexed and parsed on a thread pool: a
+// module is parsed as soon as the modules it imports are, so independent
+// modules are parsed at the same time.
+class ModuleLoader {
+ public:
+  // Modules are looked up in the directory of the main file first, then in
+  // search_path in order. Zero threads means one per hardware core.
+  explicit ModuleLoader(std::vector<std::string> search_path,
+                        size_t threads = 0);
+
+  // Throws ParseError for a missing module, an import cycle, or a class that
+  // two imported modules both define; errors from a module's lexer or parser
+  // are rethrown as ParseError prefixed with its path.
+  std::unique_ptr<LinkedProgram> Load(const std::string &main_path) const;
+
+ private:
+  std::string Resolve(const std::string &name,
+                      const std::vector<std::string> &directories) const;
+
+  std::vector<std::string> search_path_;
+  size_t threads_;
+};
+
+} /* namespace Parse */
@@ -1,94 +1,283 @@
-#include "object.h"
-#include "statement.h"
-
-#include <sstream>
-#include <string_view>
-#include <unordered_map>
-
-using namespace std;
-
-namespace Runtime {
-
-void ClassInstance::Print(std::ostream &os) {
-  auto str_method = class_.GetMethod("__str__");
-  if (str_method) {
-    str_method->body->Execute(fields_)->Print(os);
-  } else {
-    os << this;
-  }
-}
-
-bool ClassInstance::HasMethod(const std::string &method,
-                              size_t argument_count) const {
-  auto m = class_.GetMethod(method);
-  if (m) {
-    return (m->formal_params.size() == argument_count);
-  }
-  return false;
-}
-
-const Closure &ClassInstance::Fields() const {
-  return fields_;
-}
-
-Closure &ClassInstance::Fields() {
-  return fields_;
-}
-
-ClassInstance::ClassInstance(const Class &cls) : class_(cls) {
-  fields_["self"] = ObjectHolder::Share(*this);
-}
-
-ObjectHolder ClassInstance::Call(const std::string &method,
-                                 const std::vector<ObjectHolder> &actual_args) {
-  Closure method_args;
-  auto *method_ = class_.GetMethod(method);
-  for (int i = 0; i < method_->formal_params.size(); ++i) {
-    method_args[method_->formal_params[i]] = actual_args[i];
-  }
-  for (const auto &[field, value] : fields_) {
-    method_args[field] = value;
-  }
-  return method_->body->Execute(method_args);
-}
-
-Class::Class(std::string name,
-             std::vector<Method> methods,
-             const Class *parent) {
-  std::unordered_map<std::string, Method> methods_map;
-  for (auto &method : methods) {
-    methods_map[method.name] = std::move(method);
-  }
-  class_info_ = {.name = std::move(name), .methods = std::move(methods_map),
-      .parent = parent};
-}
-
-const Method *Class::GetMethod(const std::string &name) const {
-  auto found = class_info_.methods.find(name);
-  if (found != class_info_.methods.end()) {
-    return &found->second;
-  } else if (class_info_.parent) {
-    return class_info_.parent->GetMethod(name);
-  } else {
-    return nullptr;
-  }
-}
-
-void Class::Print(ostream &os) {
-  os << class_info_.name;
-}
-
-const std::string &Class::GetName() const {
-  return class_info_.name;
-}
-
-void Bool::Print(std::ostream &os) {
-  bool b = GetValue();
-  if (b) {
-    os << "True";
-  } else {
-    os << "False";
-  }
-}
-
-} /* namespace Runtime */
+#include "object.h"
+#include "heap.h"
+#include "region.h"
+#include "statement.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std;
+
+namespace Runtime {
+
+namespace {
+// Closure of a method call, taken from the closures of this thread's finished
+// calls, which keep their bucket arrays.
+class Frame {
+ public:
+  Frame() {
+    if (pool.empty()) {
+      closure_ = make_unique<Closure>();
+    } else {
+      closure_ = std::move(pool.back());
+      pool.pop_back();
+    }
+  }
+
+  ~Frame() {
+    closure_->clear();
+    pool.push_back(std::move(closure_));
+  }
+
+  Closure &Variables() {
+    return *closure_;
+  }
+
+ private:
+  unique_ptr<Closure> closure_;
+  static thread_local vector<unique_ptr<Closure>> pool;
+};
+
+thread_local vector<unique_ptr<Closure>> Frame::pool;
+
+Symbol OperatorSelector(Operator op) {
+  static const Symbol selectors[kOperatorCount] = {
+      Intern("__init__"),
+      Intern("__str__"),
+      Intern("__add__"),
+  };
+  return selectors[static_cast<size_t>(op)];
+}
+}
+
+Ast::Statement *Method::Body() const {
+  if (!body) {
+    // The body and its constants belong to the program, not to the run that
+    // first calls the method.
+    Region::Scope outside(nullptr);
+    body = parse_body();
+  }
+  return body;
+}
+
+void ClassInstance::Print(std::ostream &os) {
+  auto str_method = class_.GetOperator(Operator::kStr);
+  if (str_method) {
+    Call(CheckCall(str_method, OperatorSelector(Operator::kStr), 0), {})
+        ->Print(os);
+  } else {
+    os << this;
+  }
+}
+
+bool ClassInstance::HasMethod(std::string_view method,
+                              size_t argument_count) const {
+  auto m = class_.GetMethod(method);
+  if (m) {
+    return (m->formal_params.size() == argument_count);
+  }
+  return false;
+}
+
+ObjectHolder *ClassInstance::FindField(Symbol name) {
+  uint32_t index = shape_->IndexOf(name);
+  return index != Shape::kMissing ? &FieldAt(index) : nullptr;
+}
+
+ObjectHolder &ClassInstance::GetField(Symbol name) {
+  if (ObjectHolder *field = FindField(name)) {
+    return *field;
+  }
+  Reshape(shape_->With(name));
+  return FieldAt(shape_->Size() - 1);
+}
+
+void ClassInstance::Reshape(const Shape &shape) {
+  shape_ = &shape;
+  if (shape.Size() > kInlineFields) {
+    more_fields_.resize(shape.Size() - kInlineFields);
+  }
+}
+
+ObjectHolder ClassInstance::Create(const Class &cls) {
+  auto instance = allocate_shared<ClassInstance>(
+      SlabAllocator<ClassInstance>(), cls);
+  instance->self_ = instance;
+  Heap::Local().Track(*instance);
+  return ObjectHolder::Adopt(std::move(instance));
+}
+
+ClassInstance::ClassInstance(const Class &cls)
+    : Object(kType), class_(cls), shape_(&cls.EmptyShape()) {
+}
+
+ClassInstance::~ClassInstance() {
+  if (heap_) {
+    heap_->Untrack(*this);
+  }
+
+  // Instances referenced from the fields are let go by the outermost
+  // destructor, one after the other: dropping them from here could free a
+  // long chain of instances recursively and overflow the stack.
+  thread_local vector<ObjectHolder> released;
+  thread_local bool releasing = false;
+  for (size_t i = 0; i < shape_->Size(); ++i) {
+    ObjectHolder &field = FieldAt(i);
+    if (field.Type() == ObjectType::kClassInstance) {
+      released.push_back(std::move(field));
+    }
+  }
+  if (releasing) {
+    return;
+  }
+  releasing = true;
+  while (!released.empty()) {
+    ObjectHolder instance = std::move(released.back());
+    released.pop_back();
+  }
+  releasing = false;
+}
+
+ClassInstance &AsInstance(ObjectHolder &object) {
+  auto *instance = object.TryAs<ClassInstance>();
+  if (!instance) {
+    throw runtime_error("Only class instances have fields and methods");
+  }
+  return *instance;
+}
+
+const Method &CheckCall(const Method *method, Symbol selector,
+                        size_t argument_count) {
+  if (!method || method->formal_params.size() != argument_count) {
+    string_view name = SymbolTable::Global().Name(selector);
+    throw runtime_error("No method " + string(name) + " taking "
+                            + to_string(argument_count) + " arguments");
+  }
+  return *method;
+}
+
+ObjectHolder ClassInstance::Call(std::string_view method,
+                                 span<const ObjectHolder> actual_args) {
+  Symbol selector = Intern(method);
+  return Call(CheckCall(class_.GetMethod(selector), selector,
+                        actual_args.size()),
+              actual_args);
+}
+
+ObjectHolder ClassInstance::Call(const Method &method,
+                                 span<const ObjectHolder> actual_args) {
+  Frame frame;
+  Closure &variables = frame.Variables();
+  variables.emplace("self", Self());
+  for (size_t i = 0; i < method.formal_params.size(); ++i) {
+    variables[method.formal_params[i]] = actual_args[i];
+  }
+  return method.Body()->Execute(variables);
+}
+
+Class::Class(std::string name,
+             std::vector<Method> methods,
+             const Class *parent)
+    : Object(kType) {
+  class_info_ = {.name = std::move(name), .methods = {}, .parent = parent};
+  DefineMethods(std::move(methods));
+}
+
+void Class::DefineMethods(std::vector<Method> methods) {
+  if (table_) {
+    throw logic_error("Methods of " + class_info_.name
+                          + " defined after it was used");
+  }
+  for (auto &method : methods) {
+    class_info_.methods[method.name] = std::move(method);
+  }
+}
+
+const Method *Class::GetMethod(Symbol selector) const {
+  const auto &methods = Table().methods;
+  auto found = methods.find(selector);
+  return found != methods.end() ? found->second : nullptr;
+}
+
+const Method *Class::GetMethod(std::string_view name) const {
+  return GetMethod(Intern(name));
+}
+
+const Class::MethodTable &Class::Table() const {
+  if (table_) {
+    return *table_;
+  }
+  // The parent's entries, overridden by this class's own methods.
+  auto table = class_info_.parent
+      ? make_unique<MethodTable>(class_info_.parent->Table())
+      : make_unique<MethodTable>();
+  for (const auto &[name, method] : class_info_.methods) {
+    table->methods[Intern(name)] = &method;
+  }
+  for (size_t op = 0; op < kOperatorCount; ++op) {
+    auto found =
+        table->methods.find(OperatorSelector(static_cast<Operator>(op)));
+    table->operators[op] = found != table->methods.end() ? found->second
+                                                         : nullptr;
+  }
+  table_ = std::move(table);
+  return *table_;
+}
+
+void Class::Print(ostream &os) {
+  os << class_info_.name;
+}
+
+const std::string &Class::GetName() const {
+  return class_info_.name;
+}
+
+String::Buffer::Buffer(size_t capacity)
+    : data(make_unique_for_overwrite<char[]>(capacity)), capacity(capacity) {
+}
+
+String String::Concat(const String &lhs, const String &rhs) {
+  // Results that fit in a std::string without allocating are not worth a
+  // buffer.
+  constexpr size_t kMaxShort = 15;
+
+  string_view left = lhs.GetValue();
+  string_view right = rhs.GetValue();
+  size_t size = left.size() + right.size();
+  if (Buffer *buffer = lhs.buffer_.get(); buffer && size <= buffer->capacity) {
+    // Only the string that ends the buffer may take the room after it; rhs
+    // may share the buffer too, but never reaches past lhs.
+    size_t end = left.size();
+    if (buffer->size.compare_exchange_strong(end, size)) {
+      copy(right.begin(), right.end(), buffer->data.get() + left.size());
+      return String(lhs.buffer_, size);
+    }
+  }
+  if (size <= kMaxShort) {
+    string value;
+    value.reserve(size);
+    value.append(left).append(right);
+    return String(std::move(value));
+  }
+
+  auto buffer = allocate_shared<Buffer>(SlabAllocator<Buffer>(),
+                                        max(size, 2 * left.size()));
+  char *end = copy(left.begin(), left.end(), buffer->data.get());
+  copy(right.begin(), right.end(), end);
+  buffer->size = size;
+  return String(std::move(buffer), size);
+}
+
+void Bool::Print(std::ostream &os) {
+  bool b = GetValue();
+  if (b) {
+    os << "True";
+  } else {
+    os << "False";
+  }
+}
+
+} /* namespace Runtime */
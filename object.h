@@ -1,133 +1,183 @@
-#pragma once
-
-#include "object_holder.h"
-
-#include <ostream>
-#include <string>
-#include <string_view>
-#include <vector>
-#include <memory>
-#include <unordered_map>
-
-namespace Ast {
-class Statement;
-}
-
-class TestRunner;
-
-namespace Runtime {
-
-class Object {
- public:
-  virtual ~Object() = default;
-  virtual void Print(std::ostream &os) = 0;
-  [[nodiscard]]virtual bool IsTrue() const = 0;
-};
-
-template<typename T>
-class ValueObject : public Object {
- public:
-  ValueObject(T v) : value(v) {}
-
-  void Print(std::ostream &os) override {
-    os << value;
-  }
-
-  const T &GetValue() const {
-    return value;
-  }
-
-  virtual bool IsTrue() const override {
-    return false;
-  }
-
- private:
-  T value;
-
-  friend class Bool;
-  friend class String;
-  friend class Number;
-};
-
-class String : public ValueObject<std::string> {
-  using ValueObject<std::string>::ValueObject;
- public:
-  bool IsTrue() const override {
-    return (!GetValue().empty());
-  }
-};
-
-class Number : public ValueObject<int> {
-  using ValueObject<int>::ValueObject;
- public:
-  bool IsTrue() const override {
-    return (GetValue() != 0);
-  }
-};
-
-class Bool : public ValueObject<bool> {
- public:
-  using ValueObject<bool>::ValueObject;
-  void Print(std::ostream &os) override;
-  bool IsTrue() const override {
-    return GetValue();
-  }
-};
-
-struct Method {
-  std::string name;
-  std::vector<std::string> formal_params;
-  std::unique_ptr<Ast::Statement> body;
-};
-
-class Class;
-
-struct ClassInfo {
-  std::string name;
-  std::unordered_map<std::string, Method> methods;
-  const Class *parent;
-};
-
-class Class : public Object {
- public:
-  explicit Class(std::string name,
-                 std::vector<Method> methods,
-                 const Class *parent);
-  const Method *GetMethod(const std::string &name) const;
-  const std::string &GetName() const;
-  void Print(std::ostream &os) override;
-  bool IsTrue() const override {
-    return true;
-  }
-
- private:
-  ClassInfo class_info_;
-};
-
-class ClassInstance : public Object {
- public:
-  explicit ClassInstance(const Class &cls);
-
-  void Print(std::ostream &os) override;
-
-  ObjectHolder Call(const std::string &method,
-                    const std::vector<ObjectHolder> &actual_args);
-  bool HasMethod(const std::string &method, size_t argument_count) const;
-
-  Closure &Fields();
-  const Closure &Fields() const;
-
-  bool IsTrue() const override {
-    return true;
-  }
-
- private:
-  const Class &class_;
-  Closure fields_;
-
-  friend bool Equal(ObjectHolder lhs, ObjectHolder rhs);
-};
-
-void RunObjectsTests(TestRunner &test_runner);
-
-}
+#pragma once
+
+#include "object_holder.h"
+#include "shape.h"
+#include "symbol_table.h"
+
+#include <array>
+#include <functional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+namespace Ast {
+class Statement;
+}
+
+class TestRunner;
+
+namespace Runtime {
+
+struct Method {
+  std::string name;
+  std::vector<std::string> formal_params;
+  // Owned by the Ast::Program the class was parsed into. Null until the first
+  // call if the parser deferred it.
+  mutable Ast::Statement *body = nullptr;
+  // Set for a deferred body: parses it, throwing ParseError or LexerError.
+  std::function<Ast::Statement *()> parse_body;
+
+  // Parses a deferred body on first use.
+  Ast::Statement *Body() const;
+};
+
+class Class;
+class Heap;
+
+// Special methods the runtime calls on its own, each with a slot in every
+// class's method table.
+enum class Operator : uint8_t {
+  kInit,   // __init__
+  kStr,    // __str__
+  kAdd,    // __add__
+};
+
+constexpr size_t kOperatorCount = 3;
+
+struct ClassInfo {
+  std::string name;
+  std::unordered_map<std::string, Method, NameHash, std::equal_to<>> methods;
+  const Class *parent;
+};
+
+class Class : public Object {
+ public:
+  static constexpr ObjectType kType = ObjectType::kClass;
+
+  explicit Class(std::string name,
+                 std::vector<Method> methods,
+                 const Class *parent);
+  // Adds to the methods given to the constructor. Lets a class be created
+  // (and referred to) before its body is parsed. Throws std::logic_error once
+  // a method has been looked up.
+  void DefineMethods(std::vector<Method> methods);
+  // Methods are looked up in a table covering the class and its parents,
+  // built at the first lookup; the class and its parents must be fully
+  // defined by then.
+  const Method *GetMethod(Symbol selector) const;
+  // Interns name: prefer a selector on hot paths.
+  const Method *GetMethod(std::string_view name) const;
+  const Method *GetOperator(Operator op) const {
+    return Table().operators[static_cast<size_t>(op)];
+  }
+  const std::string &GetName() const;
+  const ClassInfo &Info() const {
+    return class_info_;
+  }
+  // Shape of the class's new instances.
+  const Shape &EmptyShape() const {
+    return *empty_shape_;
+  }
+  void Print(std::ostream &os) override;
+  bool IsTrue() const override {
+    return true;
+  }
+
+ private:
+  struct MethodTable {
+    std::unordered_map<Symbol, const Method *> methods;
+    std::array<const Method *, kOperatorCount> operators{};
+  };
+
+  const MethodTable &Table() const;
+
+  ClassInfo class_info_;
+  // Not synchronized: built by whichever thread first runs the class.
+  mutable std::unique_ptr<MethodTable> table_;
+  std::unique_ptr<Shape> empty_shape_ = std::make_unique<Shape>();
+};
+
+class ClassInstance : public Object {
+ public:
+  static constexpr ObjectType kType = ObjectType::kClassInstance;
+
+  // A new instance, tracked by the calling thread's Heap. Instances are
+  // only made this way; the constructor is public for std::make_shared.
+  static ObjectHolder Create(const Class &cls);
+
+  explicit ClassInstance(const Class &cls);
+  ~ClassInstance() override;
+
+  void Print(std::ostream &os) override;
+
+  // Runs the method in a frame holding self and the parameters, and nothing
+  // else: fields are reached through self. actual_args is only read before
+  // the body starts, so it may point into storage the body reuses.
+  ObjectHolder Call(std::string_view method,
+                    std::span<const ObjectHolder> actual_args);
+  // Calls a method already looked up in this instance's class.
+  ObjectHolder Call(const Method &method,
+                    std::span<const ObjectHolder> actual_args);
+  bool HasMethod(std::string_view method, size_t argument_count) const;
+
+  const Class &GetClass() const {
+    return class_;
+  }
+
+  // The value self is bound to in the instance's methods: a reference like
+  // any other, which keeps the instance alive.
+  ObjectHolder Self() const {
+    return ObjectHolder::Adopt(self_.lock());
+  }
+
+  // Fields are kept in the order the instance's shape gives them. The first
+  // kInlineFields are stored in the instance itself.
+  static constexpr size_t kInlineFields = 4;
+
+  const Shape &GetShape() const {
+    return *shape_;
+  }
+
+  ObjectHolder &FieldAt(size_t index) {
+    return index < kInlineFields ? inline_fields_[index]
+                                 : more_fields_[index - kInlineFields];
+  }
+
+  // The field, or null if the instance has none.
+  ObjectHolder *FindField(Symbol name);
+  // The field, added (as None) if the instance has none.
+  ObjectHolder &GetField(Symbol name);
+  // Moves the instance to shape, which must be its shape with fields added.
+  void Reshape(const Shape &shape);
+
+  bool IsTrue() const override {
+    return true;
+  }
+
+ private:
+  const Class &class_;
+  const Shape *shape_;
+  std::array<ObjectHolder, kInlineFields> inline_fields_;
+  std::vector<ObjectHolder> more_fields_;
+  std::weak_ptr<Object> self_;
+  Heap *heap_ = nullptr;
+  size_t heap_index_ = 0;
+
+  friend class Heap;
+  friend bool Equal(ObjectHolder lhs, ObjectHolder rhs);
+};
+
+// The checks every engine makes before a method call, so a bad call fails
+// the same way whichever runs it. Both throw std::runtime_error.
+ClassInstance &AsInstance(ObjectHolder &object);
+// method as looked up for a call passing argument_count arguments.
+const Method &CheckCall(const Method *method, Symbol selector,
+                        size_t argument_count);
+
+void RunObjectsTests(TestRunner &test_runner);
+
+}
@@ -1,50 +1,56 @@
-#include "object_holder.h"
-#include "object.h"
-
-namespace Runtime {
-
-ObjectHolder ObjectHolder::Share(Object &object) {
-  return ObjectHolder(std::shared_ptr<Object>(&object,
-                                              [](auto *) { /* do nothing */ }));
-}
-
-ObjectHolder ObjectHolder::None() {
-  return ObjectHolder();
-}
-
-Object &ObjectHolder::operator*() {
-  return *Get();
-}
-
-const Object &ObjectHolder::operator*() const {
-  return *Get();
-}
-
-Object *ObjectHolder::operator->() {
-  return Get();
-}
-
-const Object *ObjectHolder::operator->() const {
-  return Get();
-}
-
-Object *ObjectHolder::Get() {
-  return data.get();
-}
-
-const Object *ObjectHolder::Get() const {
-  return data.get();
-}
-
-ObjectHolder::operator bool() const {
-  return Get();
-}
-
-bool IsTrue(ObjectHolder object) {
-  if (object) {
-    return object.Get()->IsTrue();
-  } else {
-    return false;
-  }
-}
-}
+#include "object_holder.h"
+#include "object.h"
+
+namespace Runtime {
+
+ObjectHolder ObjectHolder::Share(Object &object) {
+  return ObjectHolder(std::shared_ptr<Object>(&object,
+                                              [](auto *) { /* do nothing */ }));
+}
+
+ObjectHolder ObjectHolder::None() {
+  return ObjectHolder();
+}
+
+Object &ObjectHolder::operator*() {
+  return *Get();
+}
+
+const Object &ObjectHolder::operator*() const {
+  return *Get();
+}
+
+Object *ObjectHolder::operator->() {
+  return Get();
+}
+
+const Object *ObjectHolder::operator->() const {
+  return Get();
+}
+
+Object *ObjectHolder::Get() {
+  if (auto *heap = std::get_if<std::shared_ptr<Object>>(&data)) {
+    return heap->get();
+  } else if (auto *number = std::get_if<Number>(&data)) {
+    return number;
+  }
+  return std::get_if<Bool>(&data);
+}
+
+const Object *ObjectHolder::Get() const {
+  return const_cast<ObjectHolder *>(this)->Get();
+}
+
+ObjectHolder::operator bool() const {
+  auto *heap = std::get_if<std::shared_ptr<Object>>(&data);
+  return !heap || *heap;
+}
+
+bool IsTrue(ObjectHolder object) {
+  if (object) {
+    return object.Get()->IsTrue();
+  } else {
+    return false;
+  }
+}
+}
@@ -1,58 +1,123 @@
-#pragma once
-
-#include <memory>
-#include <unordered_map>
-
-class TestRunner;
-
-namespace Runtime {
-
-class Object;
-
-class ObjectHolder {
- public:
-  ObjectHolder() = default;
-
-  template<typename T>
-  static ObjectHolder Own(T &&object) {
-    return ObjectHolder(std::make_shared<T>(std::forward<T>(object)));
-  }
-
-  static ObjectHolder Share(Object &object);
-  static ObjectHolder None();
-
-  Object &operator*();
-  const Object &operator*() const;
-  Object *operator->();
-  const Object *operator->() const;
-
-  Object *Get();
-  const Object *Get() const;
-
-  template<typename T>
-  T *TryAs() {
-    return dynamic_cast<T *>(this->Get());
-  }
-
-  template<typename T>
-  const T *TryAs() const {
-    return dynamic_cast<const T *>(this->Get());
-  }
-
-  explicit operator bool() const;
-
- private:
-  ObjectHolder(std::shared_ptr<Object> data) : data(std::move(data)) {}
-
-  std::shared_ptr<Object> data;
-};
-
-using Closure = std::unordered_map<std::string, ObjectHolder>;
-
-bool IsTrue(ObjectHolder object);
-
-void RunObjectHolderTests(TestRunner &tr);
-
-} /* namespace Runtime */
-
-using ObjectHolder = Runtime::ObjectHolder;
+#pragma once
+
+#include "slab.h"
+#include "value_object.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
+
+class TestRunner;
+
+namespace Runtime {
+
+// Numbers and booleans are kept in the holder itself, so making, copying and
+// dropping them touches neither the heap nor a reference count. Any other
+// object lives on the heap, in a slab block shared with its reference
+// counts, and is shared between copies. A pointer to a held
+// number or boolean is only valid while its holder is.
+class ObjectHolder {
+ public:
+  ObjectHolder() = default;
+
+  template<typename T>
+  static ObjectHolder Own(T &&object) {
+    using Value = std::decay_t<T>;
+    if constexpr (kImmediate<Value>) {
+      return ObjectHolder(Data(std::in_place_type<Value>,
+                               std::forward<T>(object)));
+    } else {
+      return ObjectHolder(std::shared_ptr<Object>(std::allocate_shared<Value>(
+          SlabAllocator<Value>(), std::forward<T>(object))));
+    }
+  }
+
+  // Holds an object already on the heap, sharing its ownership.
+  static ObjectHolder Adopt(std::shared_ptr<Object> object) {
+    return ObjectHolder(std::move(object));
+  }
+  static ObjectHolder Share(Object &object);
+  static ObjectHolder None();
+
+  Object &operator*();
+  const Object &operator*() const;
+  Object *operator->();
+  const Object *operator->() const;
+
+  Object *Get();
+  const Object *Get() const;
+
+  // ObjectType::kNone for None.
+  ObjectType Type() const {
+    if (auto *heap = std::get_if<std::shared_ptr<Object>>(&data)) {
+      return *heap ? (*heap)->GetType() : ObjectType::kNone;
+    }
+    return data.index() == 1 ? ObjectType::kNumber : ObjectType::kBool;
+  }
+
+  // The held object if its type is exactly T, else null. T is one of the
+  // classes declaring a kType.
+  template<typename T>
+  T *TryAs() {
+    return TryAs<T>(data);
+  }
+
+  template<typename T>
+  const T *TryAs() const {
+    return TryAs<const T>(data);
+  }
+
+  explicit operator bool() const;
+
+ private:
+  template<typename T>
+  static constexpr bool kImmediate = std::is_same_v<T, Number>
+      || std::is_same_v<T, Bool>;
+
+  using Data = std::variant<std::shared_ptr<Object>, Number, Bool>;
+
+  ObjectHolder(Data data) : data(std::move(data)) {}
+
+  template<typename T, typename Holder>
+  static T *TryAs(Holder &data) {
+    using Value = std::remove_const_t<T>;
+    if (auto *heap = std::get_if<std::shared_ptr<Object>>(&data)) {
+      Object *object = heap->get();
+      return object && object->GetType() == Value::kType
+          ? static_cast<T *>(object) : nullptr;
+    }
+    if constexpr (kImmediate<Value>) {
+      return std::get_if<Value>(&data);
+    } else {
+      return nullptr;
+    }
+  }
+
+  Data data;
+};
+
+// Lets closures be searched by std::string_view without building a key.
+struct NameHash {
+  using is_transparent = void;
+
+  size_t operator()(std::string_view name) const {
+    return std::hash<std::string_view>{}(name);
+  }
+};
+
+// Entries come from the slabs, or from the active region.
+using Closure = std::unordered_map<
+    std::string, ObjectHolder, NameHash, std::equal_to<>,
+    SlabAllocator<std::pair<const std::string, ObjectHolder>>>;
+
+bool IsTrue(ObjectHolder object);
+
+void RunObjectHolderTests(TestRunner &tr);
+
+} /* namespace Runtime */
+
+using ObjectHolder = Runtime::ObjectHolder;
@@ -0,0 +1,98 @@
+#include "operations.h"
+#include "object.h"
+
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Runtime {
+
+namespace {
+template<typename Op>
+ObjectHolder NumericOperation(const ObjectHolder &lhs, const ObjectHolder &rhs,
+                              Op op, const char *error) {
+  if (lhs.Type() == ObjectType::kNumber && rhs.Type() == ObjectType::kNumber) {
+    return ObjectHolder::Own(Number(op(lhs.TryAs<Number>()->GetValue(),
+                                       rhs.TryAs<Number>()->GetValue())));
+  }
+  throw runtime_error(error);
+}
+}
+
+ObjectHolder Add(ObjectHolder lhs, ObjectHolder rhs) {
+  switch (lhs.Type()) {
+    case ObjectType::kNumber:
+      if (auto rhs_number = rhs.TryAs<Number>()) {
+        int lhs_val = lhs.TryAs<Number>()->GetValue();
+        return ObjectHolder::Own(Number(lhs_val + rhs_number->GetValue()));
+      }
+      break;
+    case ObjectType::kString:
+      if (auto rhs_string = rhs.TryAs<String>()) {
+        return ObjectHolder::Own(
+            String::Concat(*lhs.TryAs<String>(), *rhs_string));
+      }
+      break;
+    case ObjectType::kClassInstance: {
+      auto lhs_instance = lhs.TryAs<ClassInstance>();
+      auto method = lhs_instance->GetClass().GetOperator(Operator::kAdd);
+      if (method && method->formal_params.size() == 1) {
+        ObjectHolder args[] = {std::move(rhs)};
+        return lhs_instance->Call(*method, args);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  throw runtime_error("Bad addition");
+}
+
+ObjectHolder Sub(ObjectHolder lhs, ObjectHolder rhs) {
+  return NumericOperation(lhs, rhs, [](int l, int r) { return l - r; },
+                          "Bad subtraction");
+}
+
+ObjectHolder Mult(ObjectHolder lhs, ObjectHolder rhs) {
+  return NumericOperation(lhs, rhs, [](int l, int r) { return l * r; },
+                          "Bad multiplication");
+}
+
+ObjectHolder Div(ObjectHolder lhs, ObjectHolder rhs) {
+  auto rhs_number = rhs.TryAs<Number>();
+  if (rhs_number && rhs_number->GetValue() == 0) {
+    throw runtime_error("Division by zero");
+  }
+  return NumericOperation(lhs, rhs, [](int l, int r) { return l / r; },
+                          "Bad division");
+}
+
+ObjectHolder Or(const ObjectHolder &lhs, const ObjectHolder &rhs) {
+  return ObjectHolder::Own(Bool(IsTrue(lhs) || IsTrue(rhs)));
+}
+
+ObjectHolder And(const ObjectHolder &lhs, const ObjectHolder &rhs) {
+  return ObjectHolder::Own(Bool(IsTrue(lhs) && IsTrue(rhs)));
+}
+
+ObjectHolder Not(const ObjectHolder &arg) {
+  return ObjectHolder::Own(Bool(!IsTrue(arg)));
+}
+
+ObjectHolder Stringify(ObjectHolder arg) {
+  ostringstream out;
+  PrintValue(std::move(arg), out);
+  return ObjectHolder::Own(String(out.str()));
+}
+
+void PrintValue(ObjectHolder value, std::ostream &os) {
+  if (value) {
+    value->Print(os);
+  } else {
+    os << "None";
+  }
+}
+
+} /* namespace Runtime */
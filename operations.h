@@ -0,0 +1,25 @@
+#pragma once
+
+#include "object_holder.h"
+
+#include <ostream>
+
+namespace Runtime {
+
+// Semantics of Mython's operators, shared by every execution engine. Each
+// throws std::runtime_error for operand types the operator doesn't support.
+
+ObjectHolder Add(ObjectHolder lhs, ObjectHolder rhs);
+ObjectHolder Sub(ObjectHolder lhs, ObjectHolder rhs);
+ObjectHolder Mult(ObjectHolder lhs, ObjectHolder rhs);
+ObjectHolder Div(ObjectHolder lhs, ObjectHolder rhs);
+
+ObjectHolder Or(const ObjectHolder &lhs, const ObjectHolder &rhs);
+ObjectHolder And(const ObjectHolder &lhs, const ObjectHolder &rhs);
+ObjectHolder Not(const ObjectHolder &arg);
+
+ObjectHolder Stringify(ObjectHolder arg);
+// Writes the value the way print does; None is printed as "None".
+void PrintValue(ObjectHolder value, std::ostream &os);
+
+} /* namespace Runtime */
@@ -2,91 +2,323 @@
 #include "statement.h"
 #include "lexer.h" 
 #include "comparators.h"
+#include "flat_ast.h"
+#include "scan.h"
+#include "source_buffer.h"
+#include "thread_pool.h"
 
 #include <algorithm>
+#include <exception>
 #include <string>
 #include <cctype>
 #include <vector>
 #include <optional>
+#include <unordered_map>
+#include <deque>
+#include <limits>
 
 using namespace std;
 
 namespace TokenType = Parse::TokenType;
 
 namespace {
-bool operator==(const Parse::Token &token, char c) {
+bool operator==(const Parse::TokenView &token, char c) {
   auto p = token.TryAs<TokenType::Char>();
   return p && p->value == c;
 }
 
-bool operator!=(const Parse::Token &token, char c) {
+bool operator!=(const Parse::TokenView &token, char c) {
   return !(token == c);
 }
 
+// Import -> import DottedIds Newline
+string ParseImport(Parse::Lexer &lexer) {
+  lexer.Expect<TokenType::Import>();
+  string name(lexer.ExpectNext<TokenType::IdRef>().value);
+  while (lexer.NextView() == '.') {
+    name += '.';
+    name += lexer.ExpectNext<TokenType::IdRef>().value;
+  }
+  lexer.Expect<TokenType::Newline>();
+  lexer.NextView();
+  return name;
+}
+
+// Classes created before a chunked parse (see ParseProgramParallel), in
+// source order, so that chunks can refer to classes defined in earlier ones.
+struct Predeclared {
+  vector<ObjectHolder> classes;
+  unordered_map<string_view, size_t> positions;
+};
+
+// The chunks and the pre-scan disagree about the class definitions.
+struct ChunkMismatch : logic_error {
+  using logic_error::logic_error;
+};
+
+bool IsIdentifierStart(char c) {
+  return isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// Whether [pos, end) starts with word followed by a non-identifier character.
+bool StartsWithWord(const char *pos, const char *end, string_view word) {
+  return static_cast<size_t>(end - pos) >= word.size()
+      && string_view(pos, word.size()) == word
+      && Parse::Scan::SkipIdentifier(pos + word.size(), end)
+          == pos + word.size();
+}
+
+// Calls visit(line, first) for every line of text that doesn't start inside a
+// string literal (they may span lines), with first pointing past the
+// indentation. Stops when visit returns false. Returns false if it stopped or
+// a literal is unterminated. Doesn't tokenize.
+template<typename Visit>
+bool ForEachLine(string_view text, Visit visit) {
+  namespace Scan = Parse::Scan;
+  const char *end = text.data() + text.size();
+  for (const char *pos = text.data(); pos != end;) {
+    const char *first = Scan::SkipSpaces(pos, end);
+    if (!visit(pos, first)) {
+      return false;
+    }
+    for (pos = first; pos != end && *pos != '\n'; ++pos) {
+      if (*pos == '\'' || *pos == '"') {
+        pos = Scan::FindChar(pos + 1, end, *pos);
+        if (pos == end) {
+          return false;
+        }
+      }
+    }
+    if (pos != end) {
+      ++pos;
+    }
+  }
+  return true;
+}
+
+// Whether a method body contains a class definition, which must be seen by
+// the code parsed after it and so can't be deferred. May err towards true.
+bool DefinesClass(string_view body) {
+  const char *end = body.data() + body.size();
+  return !ForEachLine(body, [end](const char *, const char *first) {
+    return !StartsWithWord(first, end, "class");
+  });
+}
+
 }
 
 class Parser {
  public:
-  explicit Parser(Parse::Lexer &lexer) : lexer(lexer) {
+  // outer_classes: classes defined outside the text being parsed, such as
+  // those of imported modules.
+  Parser(Parse::Lexer &lexer, Ast::Program &program,
+         const Runtime::Closure *outer_classes = nullptr,
+         bool lazy_methods = false)
+      : lexer(lexer), program(program), arena(program.GetArena()),
+        imports_loaded(outer_classes != nullptr), lazy_methods(lazy_methods),
+        outer_classes(outer_classes) {
+  }
+
+  // Parser for a chunk whose first class definition is
+  // predeclared.classes[first_class].
+  Parser(Parse::Lexer &lexer, Ast::Program &program,
+         const Predeclared &predeclared, size_t first_class)
+      : lexer(lexer), program(program), arena(program.GetArena()),
+        imports_loaded(false), predeclared(&predeclared),
+        first_class(first_class), next_class(first_class) {
+  }
+
+  // Parser for a method body deferred by a lazy parse of program, skipped
+  // when the program had declared visible_classes classes; it can only name
+  // those, as the body would have if it had been parsed in place.
+  Parser(Parse::Lexer &lexer, Ast::Program &program, size_t visible_classes)
+      : lexer(lexer), program(program), arena(program.GetArena()),
+        imports_loaded(true), outer_classes(&program.DeclaredClasses()),
+        visible_classes(visible_classes) {
   }
 
   // Program -> eps
-  //          | Statement \n Program
-  unique_ptr<Ast::Statement> ParseProgram() {
-    auto result = make_unique<Ast::Compound>();
-    if (lexer.CurrentToken().Is<TokenType::Newline>()) {
-      return result;
+  //          | Import* Statement \n Program
+  Ast::Statement *ParseProgram() {
+    vector<Ast::Statement *> result;
+    if (ParseProgramStart()) {
+      while (Ast::Statement *statement = ParseTopLevelStatement()) {
+        result.push_back(statement);
+      }
+    }
+
+    return arena.Make<Ast::Compound>(arena.CopyArray(result));
+  }
+
+  // Reads the imports a program starts with; false if the program is empty.
+  bool ParseProgramStart() {
+    if (lexer.CurrentView().Is<TokenType::Newline>()) {
+      return false;
     }
-    while (!lexer.CurrentToken().Is<TokenType::Eof>()) {
-      result->AddStatement(ParseStatement());
+    while (lexer.CurrentView().Is<TokenType::Import>()) {
+      if (!imports_loaded) {
+        throw ParseError(
+            "Programs with imports must be loaded by Parse::ModuleLoader");
+      }
+      ParseImport(lexer);
     }
+    return true;
+  }
 
-    return result;
+  // The next statement after ParseProgramStart, or null at the end.
+  Ast::Statement *ParseTopLevelStatement() {
+    if (lexer.CurrentView().Is<TokenType::Eof>()) {
+      return nullptr;
+    }
+    return ParseStatement();
+  }
+
+  // A method body deferred by a lazy parse.
+  Ast::Statement *ParseBody() {
+    return ParseSuite();
+  }
+
+  // Hands the classes over to the program for its deferred method bodies.
+  void KeepDeclaredClasses() {
+    program.DeclaredClasses() = std::move(declared_classes);
+    const deque<ObjectHolder> &classes = program.Classes();
+    for (size_t i = 0; i < classes.size(); ++i) {
+      program.ClassPositions().emplace(
+          classes[i].TryAs<Runtime::Class>()->GetName(), i);
+    }
+  }
+
+  // Index of the next predeclared class this parser expects to define.
+  size_t NextClass() const {
+    return next_class;
+  }
+
+  // Statements of a chunk that doesn't start the program.
+  Ast::Statement *ParseChunk() {
+    vector<Ast::Statement *> result;
+    while (!lexer.CurrentView().Is<TokenType::Eof>()) {
+      result.push_back(ParseStatement());
+    }
+    return arena.Make<Ast::Compound>(arena.CopyArray(result));
   }
 
  private:
   Parse::Lexer &lexer;
+  Ast::Program &program;
+  Ast::Arena &arena;
+  // Set when the classes of the imported modules were passed in.
+  bool imports_loaded;
+  // Record method bodies instead of parsing them; see ParseOptions.
+  bool lazy_methods = false;
   Runtime::Closure declared_classes;
+  const Runtime::Closure *outer_classes = nullptr;
+  // Set for a chunk of a parallel parse: classes defined before the chunk are
+  // looked up here, and its own definitions fill in the predeclared classes.
+  const Predeclared *predeclared = nullptr;
+  size_t first_class = 0;
+  size_t next_class = 0;
+  // Set for a deferred method body; see its constructor.
+  size_t visible_classes = numeric_limits<size_t>::max();
+
+  const Runtime::Class *FindClass(string_view name) const {
+    if (auto it = declared_classes.find(name); it != declared_classes.end()) {
+      return static_cast<const Runtime::Class *>(it->second.Get());
+    }
+    if (outer_classes) {
+      auto it = outer_classes->find(name);
+      if (it != outer_classes->end()
+          && (visible_classes == numeric_limits<size_t>::max()
+              || program.ClassPositions().at(name) < visible_classes)) {
+        return static_cast<const Runtime::Class *>(it->second.Get());
+      }
+    }
+    if (predeclared) {
+      auto it = predeclared->positions.find(name);
+      if (it != predeclared->positions.end() && it->second < first_class) {
+        return static_cast<const Runtime::Class *>(
+            predeclared->classes[it->second].Get());
+      }
+    }
+    return nullptr;
+  }
+
+  // Names are kept in the symbol table, which outlives every program.
+  static string_view Name(const TokenType::IdRef &id) {
+    return Runtime::SymbolTable::Global().Name(id.symbol);
+  }
 
   // Suite -> NEWLINE INDENT (Statement)+ DEDENT
-  unique_ptr<Ast::Statement> ParseSuite() {
+  Ast::Statement *ParseSuite() {
     lexer.Expect<TokenType::Newline>();
     lexer.ExpectNext<TokenType::Indent>();
 
-    lexer.NextToken();
+    lexer.NextView();
 
-    auto result = make_unique<Ast::Compound>();
-    while (!lexer.CurrentToken().Is<TokenType::Dedent>()) {
-      result->AddStatement(ParseStatement());
+    vector<Ast::Statement *> result;
+    while (!lexer.CurrentView().Is<TokenType::Dedent>()) {
+      result.push_back(ParseStatement());
     }
 
     lexer.Expect<TokenType::Dedent>();
-    lexer.NextToken();
+    lexer.NextView();
 
-    return result;
+    return arena.Make<Ast::Compound>(arena.CopyArray(result));
+  }
+
+  // Skips the suite at the current Newline and returns a function that parses
+  // it later, or null (having skipped nothing) if it has to be parsed now.
+  function<Ast::Statement *()> DeferSuite() {
+    // The text has to outlive the parse, so the lexer must share its buffer
+    // (ParseProgram hands it to the program).
+    if (!lexer.Source()) {
+      return nullptr;
+    }
+    int indent = lexer.IndentLevel();
+    string_view text = lexer.PeekIndentedBlock();
+    // An empty suite is a syntax error, reported by ParseSuite.
+    if (text.empty() || DefinesClass(text)) {
+      return nullptr;
+    }
+    lexer.SkipIndentedBlock();
+    lexer.NextView();
+
+    Ast::Program *owner = &program;
+    size_t visible_classes = program.Classes().size();
+    return [owner, text, indent, visible_classes] {
+      Parse::Lexer body_lexer(text, indent);
+      return Parser(body_lexer, *owner, visible_classes).ParseBody();
+    };
   }
 
   // Methods -> [def id(Params) : Suite]*
   vector<Runtime::Method> ParseMethods() {
     vector<Runtime::Method> result;
 
-    while (lexer.CurrentToken().Is<TokenType::Def>()) {
+    while (lexer.CurrentView().Is<TokenType::Def>()) {
       Runtime::Method m;
 
-      m.name = lexer.ExpectNext<TokenType::Id>().value;
+      m.name = lexer.ExpectNext<TokenType::IdRef>().value;
       lexer.ExpectNext<TokenType::Char>('(');
 
-      if (lexer.NextToken().Is<TokenType::Id>()) {
-        m.formal_params.push_back(lexer.Expect<TokenType::Id>().value);
-        while (lexer.NextToken() == ',') {
-          m.formal_params.push_back(lexer.ExpectNext<TokenType::Id>().value);
+      if (lexer.NextView().Is<TokenType::IdRef>()) {
+        m.formal_params.emplace_back(lexer.Expect<TokenType::IdRef>().value);
+        while (lexer.NextView() == ',') {
+          m.formal_params.emplace_back(
+              lexer.ExpectNext<TokenType::IdRef>().value);
         }
       }
 
       lexer.Expect<TokenType::Char>(')');
       lexer.ExpectNext<TokenType::Char>(':');
-      lexer.NextToken();
+      lexer.NextView();
 
+      if (lazy_methods && lexer.CurrentView().Is<TokenType::Newline>()) {
+        if (auto body = DeferSuite()) {
+          m.parse_body = std::move(body);
+          result.push_back(std::move(m));
+          continue;
+        }
+      }
       m.body = ParseSuite();
 
       result.push_back(std::move(m));
@@ -95,22 +327,34 @@ class Parser {
   }
 
   // ClassDefinition -> Id ['(' Id ')'] : new_line indent MethodList dedent
-  unique_ptr<Ast::Statement> ParseClassDefinition() {
-    string class_name = lexer.Expect<TokenType::Id>().value;
+  Ast::Statement *ParseClassDefinition() {
+    string class_name(lexer.Expect<TokenType::IdRef>().value);
+
+    // Taken before the methods: they may define classes of their own.
+    ObjectHolder predeclared_class;
+    if (predeclared) {
+      if (next_class == predeclared->classes.size()) {
+        throw ChunkMismatch("Class " + class_name + " wasn't predeclared");
+      }
+      predeclared_class = predeclared->classes[next_class++];
+      if (predeclared_class.TryAs<Runtime::Class>()->GetName()
+          != class_name) {
+        throw ChunkMismatch("Class " + class_name + " wasn't predeclared");
+      }
+    }
 
-    lexer.NextToken();
+    lexer.NextView();
 
     const Runtime::Class *base_class = nullptr;
-    if (lexer.CurrentToken() == '(') {
-      auto name = lexer.ExpectNext<TokenType::Id>().value;
+    if (lexer.CurrentView() == '(') {
+      string name(lexer.ExpectNext<TokenType::IdRef>().value);
       lexer.ExpectNext<TokenType::Char>(')');
-      lexer.NextToken();
+      lexer.NextView();
 
-      if (auto it = declared_classes.find(name); it == declared_classes.end()) {
+      base_class = FindClass(name);
+      if (!base_class) {
         throw ParseError(
             "Base class " + name + " not found for class " + class_name);
-      } else {
-        base_class = static_cast<const Runtime::Class *>(it->second.Get());
       }
     }
 
@@ -121,106 +365,118 @@ class Parser {
     vector<Runtime::Method> methods = ParseMethods();
 
     lexer.Expect<TokenType::Dedent>();
-    lexer.NextToken();
+    lexer.NextView();
 
-    auto [it, inserted] = declared_classes.insert(
-        {
-            class_name,
-            ObjectHolder::Own(Runtime::Class(
-                class_name,
-                std::move(methods),
-                base_class))
-        });
+    ObjectHolder cls;
+    if (predeclared_class) {
+      predeclared_class.TryAs<Runtime::Class>()->DefineMethods(
+          std::move(methods));
+      cls = std::move(predeclared_class);
+    } else {
+      cls = ObjectHolder::Own(Runtime::Class(
+          class_name,
+          std::move(methods),
+          base_class));
+    }
+    if (outer_classes && outer_classes->count(class_name)) {
+      throw ParseError("Class " + class_name + " already exists");
+    }
+    auto [it, inserted] = declared_classes.insert({class_name, std::move(cls)});
 
     if (!inserted) {
       throw ParseError("Class " + class_name + " already exists");
     }
 
-    return make_unique<Ast::ClassDefinition>(it->second);
+    return arena.Make<Ast::ClassDefinition>(program.AddClass(it->second));
   }
 
-  vector<string> ParseDottedIds() {
-    vector<string> result(1, lexer.Expect<TokenType::Id>().value);
+  vector<string_view> ParseDottedIds() {
+    vector<string_view> result(1, Name(lexer.Expect<TokenType::IdRef>()));
 
-    while (lexer.NextToken() == '.') {
-      result.push_back(lexer.ExpectNext<TokenType::Id>().value);
+    while (lexer.NextView() == '.') {
+      result.push_back(Name(lexer.ExpectNext<TokenType::IdRef>()));
     }
 
     return result;
   }
 
+  Ast::VariableValue *MakeVariableValue(const vector<string_view> &names) {
+    return arena.Make<Ast::VariableValue>(arena.CopyArray(names));
+  }
+
   //  AssgnOrCall -> DottedIds = Expr
   //               | DottedIds '(' ExprList ')'
-  unique_ptr<Ast::Statement> ParseAssignmentOrCall() {
-    lexer.Expect<TokenType::Id>();
+  Ast::Statement *ParseAssignmentOrCall() {
+    lexer.Expect<TokenType::IdRef>();
 
-    vector<string> id_list = ParseDottedIds();
-    string last_name = id_list.back();
+    vector<string_view> id_list = ParseDottedIds();
+    string_view last_name = id_list.back();
     id_list.pop_back();
 
-    if (lexer.CurrentToken() == '=') {
-      lexer.NextToken();
+    if (lexer.CurrentView() == '=') {
+      lexer.NextView();
 
       if (id_list.empty()) {
-        return make_unique<Ast::Assignment>(std::move(last_name), ParseTest());
+        return arena.Make<Ast::Assignment>(last_name, ParseTest());
       } else {
-        return make_unique<Ast::FieldAssignment>(
-            Ast::VariableValue{std::move(id_list)},
-            std::move(last_name),
+        return arena.Make<Ast::FieldAssignment>(
+            Ast::VariableValue{arena.CopyArray(id_list)},
+            last_name,
             ParseTest()
         );
       }
     } else {
       lexer.Expect<TokenType::Char>('(');
-      lexer.NextToken();
+      lexer.NextView();
 
       if (id_list.empty()) {
         throw ParseError(
-            "Mython doesn't support functions, only methods: " + last_name);
+            "Mython doesn't support functions, only methods: "
+                + string(last_name));
       }
 
-      vector<unique_ptr<Ast::Statement>> args;
-      if (lexer.CurrentToken() != ')') {
+      vector<Ast::Statement *> args;
+      if (lexer.CurrentView() != ')') {
         args = ParseTestList();
       }
       lexer.Expect<TokenType::Char>(')');
-      lexer.NextToken();
+      lexer.NextView();
 
-      return make_unique<Ast::MethodCall>(
-          make_unique<Ast::VariableValue>(std::move(id_list)),
-          std::move(last_name),
-          std::move(args)
+      return arena.Make<Ast::MethodCall>(
+          MakeVariableValue(id_list),
+          last_name,
+          arena.CopyArray(args)
       );
     }
   }
 
   // Expr -> Adder ['+'/'-' Adder]*
-  unique_ptr<Ast::Statement> ParseExpression() {
-    unique_ptr<Ast::Statement> result = ParseAdder();
-    while (lexer.CurrentToken() == '+' || lexer.CurrentToken() == '-') {
-      char op = lexer.CurrentToken().As<TokenType::Char>().value;
-      lexer.NextToken();
+  Ast::Statement *ParseExpression() {
+    Ast::Statement *result = ParseAdder();
+    while (lexer.CurrentView() == '+' || lexer.CurrentView() == '-') {
+      char op = lexer.CurrentView().As<TokenType::Char>().value;
+      lexer.NextView();
 
       if (op == '+') {
-        result = make_unique<Ast::Add>(std::move(result), ParseAdder());
+        result = arena.Make<Ast::Add>(result, ParseAdder());
       } else {
-        result = make_unique<Ast::Sub>(std::move(result), ParseAdder());
+        result = arena.Make<Ast::Sub>(result, ParseAdder());
       }
     }
     return result;
   }
 
   // Adder -> Mult ['*'/'/' Mult]*
-  unique_ptr<Ast::Statement> ParseAdder() {
-    unique_ptr<Ast::Statement> result = ParseMult();
-    while (lexer.CurrentToken() == '*' || lexer.CurrentToken() == '/') {
-      char op = lexer.CurrentToken().As<TokenType::Char>().value;
-      lexer.NextToken();
+  Ast::Statement *ParseAdder() {
+    Ast::Statement *result = ParseMult();
+    while (lexer.CurrentView() == '*' || lexer.CurrentView() == '/') {
+      char op = lexer.CurrentView().As<TokenType::Char>().value;
+      lexer.NextView();
 
       if (op == '*') {
-        result = make_unique<Ast::Mult>(std::move(result), ParseMult());
+        result = arena.Make<Ast::Mult>(result, ParseMult());
       } else {
-        result = make_unique<Ast::Div>(std::move(result), ParseMult());
+        result = arena.Make<Ast::Div>(result, ParseMult());
       }
     }
     return result;
@@ -235,178 +491,178 @@ class Parser {
   //       | FALSE
   //       | DottedIds '(' ExprList ')'
   //       | DottedIds
-  unique_ptr<Ast::Statement> ParseMult() {
-    if (lexer.CurrentToken() == '(') {
-      lexer.NextToken();
+  Ast::Statement *ParseMult() {
+    if (lexer.CurrentView() == '(') {
+      lexer.NextView();
       auto result = ParseTest();
       lexer.Expect<TokenType::Char>(')');
-      lexer.NextToken();
+      lexer.NextView();
       return result;
-    } else if (lexer.CurrentToken() == '-') {
-      lexer.NextToken();
-      return make_unique<Ast::Mult>(
+    } else if (lexer.CurrentView() == '-') {
+      lexer.NextView();
+      return arena.Make<Ast::Mult>(
           ParseMult(),
-          make_unique<Ast::NumericConst>(-1)
+          arena.Make<Ast::NumericConst>(
+              program.AddConstant(ObjectHolder::Own(Runtime::Number(-1))))
       );
-    } else if (auto num = lexer.CurrentToken().TryAs<TokenType::Number>()) {
+    } else if (auto num = lexer.CurrentView().TryAs<TokenType::Number>()) {
       int result = num->value;
-      lexer.NextToken();
-      return make_unique<Ast::NumericConst>(result);
-    } else if (auto str = lexer.CurrentToken().TryAs<TokenType::String>()) {
-      string result = str->value;
-      lexer.NextToken();
-      return make_unique<Ast::StringConst>(std::move(result));
-    } else if (lexer.CurrentToken().Is<TokenType::True>()) {
-      lexer.NextToken();
-      return make_unique<Ast::BoolConst>(Runtime::Bool(true));
-    } else if (lexer.CurrentToken().Is<TokenType::False>()) {
-      lexer.NextToken();
-      return make_unique<Ast::BoolConst>(Runtime::Bool(false));
-    } else if (lexer.CurrentToken().Is<TokenType::None>()) {
-      lexer.NextToken();
-      return make_unique<Ast::None>();
+      lexer.NextView();
+      return arena.Make<Ast::NumericConst>(
+          program.AddConstant(ObjectHolder::Own(Runtime::Number(result))));
+    } else if (auto str = lexer.CurrentView().TryAs<TokenType::StringRef>()) {
+      string result(str->value);
+      lexer.NextView();
+      return arena.Make<Ast::StringConst>(program.AddConstant(
+          ObjectHolder::Own(Runtime::String(std::move(result)))));
+    } else if (lexer.CurrentView().Is<TokenType::True>()) {
+      lexer.NextView();
+      return arena.Make<Ast::BoolConst>(
+          program.AddConstant(ObjectHolder::Own(Runtime::Bool(true))));
+    } else if (lexer.CurrentView().Is<TokenType::False>()) {
+      lexer.NextView();
+      return arena.Make<Ast::BoolConst>(
+          program.AddConstant(ObjectHolder::Own(Runtime::Bool(false))));
+    } else if (lexer.CurrentView().Is<TokenType::None>()) {
+      lexer.NextView();
+      return arena.Make<Ast::None>();
     } else {
-      vector<string> names = ParseDottedIds();
+      vector<string_view> names = ParseDottedIds();
 
-      if (lexer.CurrentToken() == '(') {
+      if (lexer.CurrentView() == '(') {
         // various calls
-        vector<unique_ptr<Ast::Statement>> args;
-        if (lexer.NextToken() != ')') {
+        vector<Ast::Statement *> args;
+        if (lexer.NextView() != ')') {
           args = ParseTestList();
         }
         lexer.Expect<TokenType::Char>(')');
-        lexer.NextToken();
+        lexer.NextView();
 
         auto method_name = names.back();
         names.pop_back();
 
         if (!names.empty()) {
-          return make_unique<Ast::MethodCall>(
-              make_unique<Ast::VariableValue>(std::move(names)),
-              std::move(method_name),
-              std::move(args)
-          );
-        } else if (auto it = declared_classes.find(method_name); it
-            != end(declared_classes)) {
-          return make_unique<Ast::NewInstance>(
-              static_cast<const Runtime::Class &>(*it->second), std::move(args)
+          return arena.Make<Ast::MethodCall>(
+              MakeVariableValue(names),
+              method_name,
+              arena.CopyArray(args)
           );
+        } else if (auto cls = FindClass(method_name)) {
+          return arena.Make<Ast::NewInstance>(*cls, arena.CopyArray(args));
         } else if (method_name == "str") {
           if (args.size() != 1) {
             throw ParseError("Function str takes exactly one argument");
           }
-          return make_unique<Ast::Stringify>(std::move(args.front()));
+          return arena.Make<Ast::Stringify>(args.front());
         } else {
-          throw ParseError("Unknown call to " + method_name + "()");
+          throw ParseError("Unknown call to " + string(method_name) + "()");
         }
       } else {
-        return make_unique<Ast::VariableValue>(std::move(names));
+        return MakeVariableValue(names);
       }
     }
   }
 
-  vector<unique_ptr<Ast::Statement>> ParseTestList() {
-    vector<unique_ptr<Ast::Statement>> result;
+  vector<Ast::Statement *> ParseTestList() {
+    vector<Ast::Statement *> result;
     result.push_back(ParseTest());
 
-    while (lexer.CurrentToken() == ',') {
-      lexer.NextToken();
+    while (lexer.CurrentView() == ',') {
+      lexer.NextView();
       result.push_back(ParseTest());
     }
     return result;
   }
 
   // Condition -> if LogicalExpr: Suite [else: Suite]
-  unique_ptr<Ast::Statement> ParseCondition() {
+  Ast::Statement *ParseCondition() {
     lexer.Expect<TokenType::If>();
-    lexer.NextToken();
+    lexer.NextView();
 
     auto condition = ParseTest();
 
     lexer.Expect<TokenType::Char>(':');
-    lexer.NextToken();
+    lexer.NextView();
 
     auto if_body = ParseSuite();
 
-    unique_ptr<Ast::Statement> else_body;
-    if (lexer.CurrentToken().Is<TokenType::Else>()) {
+    Ast::Statement *else_body = nullptr;
+    if (lexer.CurrentView().Is<TokenType::Else>()) {
       lexer.ExpectNext<TokenType::Char>(':');
-      lexer.NextToken();
+      lexer.NextView();
       else_body = ParseSuite();
     }
 
-    return make_unique<Ast::IfElse>(std::move(condition),
-                                    std::move(if_body),
-                                    std::move(else_body));
+    return arena.Make<Ast::IfElse>(condition, if_body, else_body);
   }
 
   // LogicalExpr -> AndTest [OR AndTest]
   // AndTest -> NotTest [AND NotTest]
   // NotTest -> [NOT] NotTest
   //          | Comparison
-  unique_ptr<Ast::Statement> ParseTest() {
+  Ast::Statement *ParseTest() {
     auto result = ParseAndTest();
-    while (lexer.CurrentToken().Is<TokenType::Or>()) {
-      lexer.NextToken();
-      result = make_unique<Ast::Or>(std::move(result), ParseAndTest());
+    while (lexer.CurrentView().Is<TokenType::Or>()) {
+      lexer.NextView();
+      result = arena.Make<Ast::Or>(result, ParseAndTest());
     }
     return result;
   }
 
-  unique_ptr<Ast::Statement> ParseAndTest() {
+  Ast::Statement *ParseAndTest() {
     auto result = ParseNotTest();
-    while (lexer.CurrentToken().Is<TokenType::And>()) {
-      lexer.NextToken();
-      result = make_unique<Ast::And>(std::move(result), ParseNotTest());
+    while (lexer.CurrentView().Is<TokenType::And>()) {
+      lexer.NextView();
+      result = arena.Make<Ast::And>(result, ParseNotTest());
     }
     return result;
   }
 
-  unique_ptr<Ast::Statement> ParseNotTest() {
-    if (lexer.CurrentToken().Is<TokenType::Not>()) {
-      lexer.NextToken();
-      return make_unique<Ast::Not>(ParseNotTest());
+  Ast::Statement *ParseNotTest() {
+    if (lexer.CurrentView().Is<TokenType::Not>()) {
+      lexer.NextView();
+      return arena.Make<Ast::Not>(ParseNotTest());
     } else {
       return ParseComparison();
     }
   }
 
   // Comparison -> Expr [COMP_OP Expr]
-  unique_ptr<Ast::Statement> ParseComparison() {
+  Ast::Statement *ParseComparison() {
     auto result = ParseExpression();
 
-    const auto tok = lexer.CurrentToken();
+    const auto tok = lexer.CurrentView();
 
     if (tok == '<') {
-      lexer.NextToken();
-      return make_unique<Ast::Comparison>(Runtime::Less,
-                                          std::move(result),
-                                          ParseExpression());
+      lexer.NextView();
+      return arena.Make<Ast::Comparison>(Runtime::Less,
+                                         result,
+                                         ParseExpression());
     } else if (tok == '>') {
-      lexer.NextToken();
-      return make_unique<Ast::Comparison>(Runtime::Greater,
-                                          std::move(result),
-                                          ParseExpression());
+      lexer.NextView();
+      return arena.Make<Ast::Comparison>(Runtime::Greater,
+                                         result,
+                                         ParseExpression());
     } else if (tok.Is<TokenType::Eq>()) {
-      lexer.NextToken();
-      return make_unique<Ast::Comparison>(Runtime::Equal,
-                                          std::move(result),
-                                          ParseExpression());
+      lexer.NextView();
+      return arena.Make<Ast::Comparison>(Runtime::Equal,
+                                         result,
+                                         ParseExpression());
     } else if (tok.Is<TokenType::NotEq>()) {
-      lexer.NextToken();
-      return make_unique<Ast::Comparison>(Runtime::NotEqual,
-                                          std::move(result),
-                                          ParseExpression());
+      lexer.NextView();
+      return arena.Make<Ast::Comparison>(Runtime::NotEqual,
+                                         result,
+                                         ParseExpression());
     } else if (tok.Is<TokenType::LessOrEq>()) {
-      lexer.NextToken();
-      return make_unique<Ast::Comparison>(Runtime::LessOrEqual,
-                                          std::move(result),
-                                          ParseExpression());
+      lexer.NextView();
+      return arena.Make<Ast::Comparison>(Runtime::LessOrEqual,
+                                         result,
+                                         ParseExpression());
     } else if (tok.Is<TokenType::GreaterOrEq>()) {
-      lexer.NextToken();
-      return make_unique<Ast::Comparison>(Runtime::GreaterOrEqual,
-                                          std::move(result),
-                                          ParseExpression());
+      lexer.NextView();
+      return arena.Make<Ast::Comparison>(Runtime::GreaterOrEqual,
+                                         result,
+                                         ParseExpression());
     } else {
       return result;
     }
@@ -415,18 +671,20 @@ class Parser {
   //Statement -> SimpleStatement Newline
   //           | class ClassDefinition
   //           | if Condition
-  unique_ptr<Ast::Statement> ParseStatement() {
-    const auto &tok = lexer.CurrentToken();
+  Ast::Statement *ParseStatement() {
+    const auto &tok = lexer.CurrentView();
 
     if (tok.Is<TokenType::Class>()) {
-      lexer.NextToken();
+      lexer.NextView();
       return ParseClassDefinition();
     } else if (tok.Is<TokenType::If>()) {
       return ParseCondition();
+    } else if (tok.Is<TokenType::Import>()) {
+      throw ParseError("import must come before any other statement");
     } else {
       auto result = ParseSimpleStatement();
       lexer.Expect<TokenType::Newline>();
-      lexer.NextToken();
+      lexer.NextView();
       return result;
     }
   }
@@ -434,25 +692,318 @@ class Parser {
   //StatementBody -> return Expression
   //               | print ExpressionList
   //               | AssignmentOrCall
-  unique_ptr<Ast::Statement> ParseSimpleStatement() {
-    const auto &tok = lexer.CurrentToken();
+  Ast::Statement *ParseSimpleStatement() {
+    const auto &tok = lexer.CurrentView();
 
     if (tok.Is<TokenType::Return>()) {
-      lexer.NextToken();
-      return make_unique<Ast::Return>(ParseTest());
+      lexer.NextView();
+      return arena.Make<Ast::Return>(ParseTest());
     } else if (tok.Is<TokenType::Print>()) {
-      lexer.NextToken();
-      vector<unique_ptr<Ast::Statement>> args;
-      if (!lexer.CurrentToken().Is<TokenType::Newline>()) {
+      lexer.NextView();
+      vector<Ast::Statement *> args;
+      if (!lexer.CurrentView().Is<TokenType::Newline>()) {
         args = ParseTestList();
       }
-      return make_unique<Ast::Print>(std::move(args));
+      return arena.Make<Ast::Print>(arena.CopyArray(args));
     } else {
       return ParseAssignmentOrCall();
     }
   }
 };
 
-unique_ptr<Ast::Statement> ParseProgram(Parse::Lexer &lexer) {
-  return Parser{lexer}.ParseProgram();
+namespace {
+
+struct ClassHeader {
+  string_view name;
+  string_view base;  // empty for a root class
+};
+
+// A run of top-level statements, as byte offsets into the source.
+struct Chunk {
+  size_t begin;
+  size_t end;
+  size_t first_class;  // index of its first class definition
+};
+
+struct Layout {
+  vector<Chunk> chunks;
+  vector<ClassHeader> classes;
+};
+
+// ClassHeader -> class Id ['(' Id ')'] ':'
+optional<ClassHeader> ScanClassHeader(const char *pos, const char *end) {
+  namespace Scan = Parse::Scan;
+  auto identifier = [&pos, end]() -> string_view {
+    pos = Scan::SkipSpaces(pos, end);
+    if (pos == end || !IsIdentifierStart(*pos)) {
+      return {};
+    }
+    const char *begin = pos;
+    pos = Scan::SkipIdentifier(pos, end);
+    return {begin, static_cast<size_t>(pos - begin)};
+  };
+
+  pos += "class"sv.size();
+  ClassHeader header{identifier(), {}};
+  if (header.name.empty()) {
+    return nullopt;
+  }
+  pos = Scan::SkipSpaces(pos, end);
+  if (pos != end && *pos == '(') {
+    ++pos;
+    header.base = identifier();
+    pos = Scan::SkipSpaces(pos, end);
+    if (header.base.empty() || pos == end || *pos++ != ')') {
+      return nullopt;
+    }
+    pos = Scan::SkipSpaces(pos, end);
+  }
+  if (pos == end || *pos != ':') {
+    return nullopt;
+  }
+  return header;
+}
+
+// Whether the lexer reads the line at line as part of the one before it. After
+// a token it skips all whitespace, newlines included, unless a newline comes
+// first: a line ending in a space, tab or '\r' runs on into the next.
+bool JoinsPreviousLine(const char *begin, const char *line) {
+  const char *pos = line;
+  while (pos != begin && isspace(static_cast<unsigned char>(pos[-1]))) {
+    --pos;
+  }
+  return pos != begin && *pos != '\n';
+}
+
+// Splits the source into chunks of at least chunk_size bytes at lines that
+// start a top-level statement (column 0, not an else, not joined to the line
+// before it), and lists every class definition in source order. Returns
+// nullopt for anything it doesn't understand; the caller then parses
+// serially, which reports the error.
+optional<Layout> ScanLayout(string_view text, size_t chunk_size) {
+  Layout layout;
+  const char *begin = text.data();
+  const char *end = begin + text.size();
+  const char *chunk_begin = begin;
+  size_t chunk_first_class = 0;
+
+  bool scanned = ForEachLine(text, [&](const char *line, const char *first) {
+    if (first == line && !isspace(static_cast<unsigned char>(*line))
+        && static_cast<size_t>(line - chunk_begin) >= chunk_size
+        && !StartsWithWord(line, end, "else")
+        && !JoinsPreviousLine(begin, line)) {
+      layout.chunks.push_back({static_cast<size_t>(chunk_begin - begin),
+                               static_cast<size_t>(line - begin),
+                               chunk_first_class});
+      chunk_begin = line;
+      chunk_first_class = layout.classes.size();
+    }
+
+    if (StartsWithWord(first, end, "class")) {
+      auto header = ScanClassHeader(first, end);
+      if (!header) {
+        return false;
+      }
+      layout.classes.push_back(*header);
+    }
+    return true;
+  });
+  if (!scanned) {
+    return nullopt;
+  }
+
+  layout.chunks.push_back({static_cast<size_t>(chunk_begin - begin),
+                           text.size(), chunk_first_class});
+  return layout;
+}
+
+// Creates the classes of the layout ahead of parsing. Returns nullopt if a
+// name repeats or a base class isn't defined earlier: the serial parser
+// reports those.
+optional<Predeclared> Predeclare(const vector<ClassHeader> &headers) {
+  Predeclared result;
+  result.classes.reserve(headers.size());
+  for (const ClassHeader &header : headers) {
+    const Runtime::Class *base = nullptr;
+    if (!header.base.empty()) {
+      auto it = result.positions.find(header.base);
+      if (it == result.positions.end()) {
+        return nullopt;
+      }
+      base = result.classes[it->second].TryAs<Runtime::Class>();
+    }
+    if (!result.positions.emplace(header.name, result.classes.size()).second) {
+      return nullopt;
+    }
+    result.classes.push_back(ObjectHolder::Own(
+        Runtime::Class(string(header.name), {}, base)));
+  }
+  return result;
+}
+
+// Chunks smaller than this aren't worth a task.
+constexpr size_t kMinChunkSize = 64 * 1024;
+
+} /* namespace */
+
+StreamingRunner::StreamingRunner(Parse::Lexer &lexer)
+    : program_(make_unique<Ast::Program>()),
+      parser_(make_unique<Parser>(lexer, *program_)) {
+}
+
+StreamingRunner::~StreamingRunner() = default;
+
+bool StreamingRunner::Step(Runtime::Closure &closure) {
+  if (finished_) {
+    return false;
+  }
+  if (!started_) {
+    started_ = true;
+    if (!parser_->ParseProgramStart()) {
+      finished_ = true;
+      return false;
+    }
+  }
+
+  // Nodes of a statement that defines no class aren't needed once it has run
+  // (or failed).
+  Ast::Program::Mark mark = program_->GetMark();
+  auto release = [this, &mark] {
+    if (program_->Classes().size() == mark.classes) {
+      program_->Rewind(mark);
+    }
+  };
+
+  bool stops = false;
+  try {
+    Ast::Statement *statement = parser_->ParseTopLevelStatement();
+    if (!statement) {
+      finished_ = true;
+      return false;
+    }
+    Ast::Completion completion = Ast::ExecuteStatement(*statement, closure);
+    stops = completion.returned;
+    if (stops) {
+      result_ = std::move(completion.value);
+    }
+  } catch (...) {
+    finished_ = true;
+    release();
+    throw;
+  }
+  release();
+
+  finished_ = stops;
+  return true;
+}
+
+ObjectHolder StreamingRunner::Run(Runtime::Closure &closure) {
+  while (Step(closure)) {
+  }
+  return result_;
+}
+
+unique_ptr<Ast::Program> ParseProgram(Parse::Lexer &lexer) {
+  auto program = make_unique<Ast::Program>();
+  program->SetRoot(Parser{lexer, *program}.ParseProgram());
+  return program;
+}
+
+unique_ptr<Ast::Program> ParseProgram(
+    Parse::Lexer &lexer, const Runtime::Closure &imported_classes) {
+  auto program = make_unique<Ast::Program>();
+  program->SetRoot(Parser{lexer, *program, &imported_classes}.ParseProgram());
+  return program;
+}
+
+unique_ptr<Ast::Program> ParseProgram(Parse::Lexer &lexer,
+                                      const ParseOptions &options) {
+  auto program = make_unique<Ast::Program>();
+  Parser parser(lexer, *program, nullptr, options.lazy_methods);
+  program->SetRoot(parser.ParseProgram());
+  if (options.lazy_methods) {
+    parser.KeepDeclaredClasses();
+    program->Retain(lexer.Source());
+  }
+  return program;
+}
+
+vector<string> ParseImports(Parse::Lexer &lexer) {
+  vector<string> result;
+  while (lexer.CurrentView().Is<TokenType::Import>()) {
+    result.push_back(ParseImport(lexer));
+  }
+  return result;
+}
+
+unique_ptr<Ast::Program> ParseProgramParallel(
+    shared_ptr<const Parse::SourceBuffer> source, size_t threads) {
+  auto parse_serially = [&source] {
+    Parse::Lexer lexer(source);
+    return ParseProgram(lexer);
+  };
+
+  string_view text = source->Text();
+  Parse::ThreadPool pool(threads);
+  size_t chunk_size = max(kMinChunkSize, text.size() / (pool.Size() * 4));
+  optional<Layout> layout = ScanLayout(text, chunk_size);
+  if (!layout || layout->chunks.size() < 2) {
+    return parse_serially();
+  }
+  optional<Predeclared> predeclared = Predeclare(layout->classes);
+  if (!predeclared) {
+    return parse_serially();
+  }
+
+  size_t count = layout->chunks.size();
+  vector<unique_ptr<Ast::Program>> parts(count);
+  vector<exception_ptr> errors(count);
+  for (size_t i = 0; i < count; ++i) {
+    pool.Submit([&, i] {
+      try {
+        const Chunk &chunk = layout->chunks[i];
+        Parse::Lexer lexer(text.substr(chunk.begin, chunk.end - chunk.begin));
+        parts[i] = make_unique<Ast::Program>();
+        Parser parser(lexer, *parts[i], *predeclared, chunk.first_class);
+        parts[i]->SetRoot(i == 0 ? parser.ParseProgram() : parser.ParseChunk());
+        size_t next_chunk_class = i + 1 < count
+            ? layout->chunks[i + 1].first_class : layout->classes.size();
+        if (parser.NextClass() != next_chunk_class) {
+          throw ChunkMismatch("Chunk defined an unexpected number of classes");
+        }
+      } catch (...) {
+        errors[i] = current_exception();
+      }
+    });
+  }
+  pool.Wait();
+
+  // The first failing chunk holds the error a serial parse would report.
+  for (const exception_ptr &error : errors) {
+    if (error) {
+      try {
+        rethrow_exception(error);
+      } catch (const ChunkMismatch &) {
+        return parse_serially();
+      }
+    }
+  }
+
+  auto program = make_unique<Ast::Program>();
+  vector<Ast::Statement *> statements;
+  for (auto &part : parts) {
+    auto body = static_cast<const Ast::Compound *>(part->Root())->Statements();
+    statements.insert(statements.end(), body.begin(), body.end());
+    program->Adopt(std::move(part));
+  }
+  for (ObjectHolder &cls : predeclared->classes) {
+    program->AddClass(std::move(cls));
+  }
+  Ast::Arena &arena = program->GetArena();
+  program->SetRoot(arena.Make<Ast::Compound>(arena.CopyArray(statements)));
+  return program;
+}
+
+unique_ptr<Flat::Program> ParseFlatProgram(Parse::Lexer &lexer) {
+  return Flat::Lower(*ParseProgram(lexer));
 }
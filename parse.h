@@ -1,24 +1,95 @@
-#pragma once
-
-#include <memory>
-#include <stdexcept>
-
-namespace Ast {
-class Statement;
-}
-
-namespace Parse {
-class Lexer;
-}
-
-class TestRunner;
-
-struct ParseError : std::runtime_error {
-  using std::runtime_error::runtime_error;
-};
-
-std::unique_ptr<Ast::Statement> ParseProgram(Parse::Lexer &lexer);
-
-namespace Parse {
-void TestParseProgram(TestRunner &tr);
-}
+#pragma once
+
+#include "object_holder.h"
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Ast {
+class Program;
+}
+
+namespace Flat {
+struct Program;
+}
+
+namespace Parse {
+class Lexer;
+class SourceBuffer;
+}
+
+class TestRunner;
+
+struct ParseError : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+struct ParseOptions {
+  // Skip method bodies and parse each on its first call, caching the result
+  // in its Runtime::Method; syntax errors in a body are then thrown by that
+  // call. Bodies that define classes are still parsed up front. Only applies
+  // when the lexer owns or shares its buffer, which the program then keeps.
+  bool lazy_methods = false;
+};
+
+std::unique_ptr<Ast::Program> ParseProgram(Parse::Lexer &lexer);
+std::unique_ptr<Ast::Program> ParseProgram(Parse::Lexer &lexer,
+                                           const ParseOptions &options);
+// Parses a module whose imports are already loaded; imported_classes are the
+// classes they make visible. See Parse::ModuleLoader.
+std::unique_ptr<Ast::Program> ParseProgram(
+    Parse::Lexer &lexer, const Runtime::Closure &imported_classes);
+// Same result as ParseProgram, for large single files: splits the source at
+// top-level statements and parses the pieces on a thread pool (zero threads
+// means one per core), then joins them into one Compound. Classes are created
+// up front from a pre-scan of their headers, so a piece can use the classes
+// defined before it exactly as in a serial parse. Falls back to the serial
+// parser for small inputs and for anything the pre-scan can't vouch for.
+std::unique_ptr<Ast::Program> ParseProgramParallel(
+    std::shared_ptr<const Parse::SourceBuffer> source, size_t threads = 0);
+
+class Parser;
+
+// Runs a program while parsing it: each top-level statement is executed as
+// soon as it is parsed, and its nodes are released after it has run unless it
+// defined a class. A syntax error is thrown when the parser reaches it, after
+// everything before it has run. The program ends like a Compound does (e.g.
+// at a top-level return) or at the first error.
+class StreamingRunner {
+ public:
+  explicit StreamingRunner(Parse::Lexer &lexer);
+  ~StreamingRunner();
+
+  // Parses and runs the next statement; false (running nothing) once the
+  // program has ended.
+  bool Step(Runtime::Closure &closure);
+  // Steps to the end. Returns the value the program ended with, or None.
+  ObjectHolder Run(Runtime::Closure &closure);
+
+  // Holds the classes defined so far: closures using them must not outlive
+  // the runner.
+  const Ast::Program &GetProgram() const {
+    return *program_;
+  }
+
+ private:
+  std::unique_ptr<Ast::Program> program_;
+  std::unique_ptr<Parser> parser_;
+  bool started_ = false;
+  bool finished_ = false;
+  ObjectHolder result_;
+};
+
+// Module names of the import statements at the current position, which must
+// be the start of a program. Leaves the lexer on the first other token.
+std::vector<std::string> ParseImports(Parse::Lexer &lexer);
+// Parses into the compact Flat representation; the intermediate tree is
+// dropped before returning.
+std::unique_ptr<Flat::Program> ParseFlatProgram(Parse::Lexer &lexer);
+
+namespace Parse {
+void TestParseProgram(TestRunner &tr);
+}
@@ -0,0 +1,442 @@
+#include "program_cache.h"
+#include "flat_ast.h"
+#include "lexer.h"
+#include "object.h"
+#include "parse.h"
+#include "source_buffer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+using namespace std;
+
+namespace Flat {
+
+namespace {
+
+constexpr char kMagic[8] = {'M', 'Y', 'T', 'H', 'O', 'N', 'F', 'P'};
+// Bump whenever the layout of the file or of the Flat tables changes.
+constexpr uint32_t kVersion = 1;
+// Written as is, so a file from a machine with the other byte order fails the
+// check instead of being misread.
+constexpr uint32_t kByteOrder = 0x01020304;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t source_hash;
+  uint64_t checksum;  // of everything after the header
+  uint32_t node_count;
+  uint32_t list_size;
+  uint32_t name_count;
+  uint32_t constant_count;
+  uint32_t class_count;
+  uint32_t method_count;
+  uint32_t root;
+  uint32_t blob_size;
+};
+
+// Names and string literals are slices of the blob that ends the file.
+struct NameEntry {
+  uint32_t offset;
+  uint32_t size;
+};
+
+enum class ConstantType : uint32_t {
+  kNumber,
+  kString,
+  kBool,
+};
+
+struct ConstantEntry {
+  ConstantType type;
+  uint32_t value;  // number or bool, or blob offset of a string
+  uint32_t size;   // string length
+};
+
+static_assert(is_trivially_copyable_v<Header>);
+static_assert(is_trivially_copyable_v<array<Index, 3>>);
+static_assert(is_trivially_copyable_v<ClassEntry>);
+static_assert(is_trivially_copyable_v<MethodEntry>);
+
+uint64_t Hash(string_view data) {
+  // FNV-1a over 8-byte words with an extra shift to spread high bits down.
+  // Not cryptographic: it only has to tell different sources apart.
+  constexpr uint64_t kPrime = 0x100000001b3;
+  uint64_t hash = 0xcbf29ce484222325;
+  const char *pos = data.data();
+  const char *end = pos + data.size();
+  for (; end - pos >= 8; pos += 8) {
+    uint64_t word;
+    memcpy(&word, pos, 8);
+    hash = (hash ^ word) * kPrime;
+    hash ^= hash >> 29;
+  }
+  for (; pos != end; ++pos) {
+    hash = (hash ^ static_cast<unsigned char>(*pos)) * kPrime;
+  }
+  return (hash ^ data.size()) * kPrime;
+}
+
+template<typename T>
+void Append(string &out, const vector<T> &items) {
+  out.append(reinterpret_cast<const char *>(items.data()),
+             items.size() * sizeof(T));
+}
+
+// Reads consecutive sections of a file whose total size was checked up front.
+class Reader {
+ public:
+  explicit Reader(const char *pos) : pos_(pos) {
+  }
+
+  template<typename T>
+  void Read(vector<T> &items, size_t count) {
+    items.resize(count);
+    memcpy(items.data(), pos_, count * sizeof(T));
+    pos_ += count * sizeof(T);
+  }
+
+  const char *Position() const {
+    return pos_;
+  }
+
+ private:
+  const char *pos_;
+};
+
+size_t PayloadSize(const Header &header) {
+  return size_t(header.node_count) * (sizeof(array<Index, 3>) + sizeof(Kind))
+      + size_t(header.list_size) * sizeof(Index)
+      + size_t(header.class_count) * sizeof(ClassEntry)
+      + size_t(header.method_count) * sizeof(MethodEntry)
+      + size_t(header.name_count) * sizeof(NameEntry)
+      + size_t(header.constant_count) * sizeof(ConstantEntry)
+      + header.blob_size;
+}
+
+// Checks that every index in the tables is in range and that children come
+// before their parents (as Lower emits them), so the executor can't be sent
+// out of bounds or into a cycle by a damaged file.
+class Validator {
+ public:
+  explicit Validator(const Program &program) : program_(program) {
+  }
+
+  bool Valid() const {
+    Index nodes = program_.NodeCount();
+    if (program_.operands.size() != nodes || program_.root >= nodes) {
+      return false;
+    }
+    for (Index node = 0; node < nodes; ++node) {
+      if (!ValidNode(node)) {
+        return false;
+      }
+    }
+    for (Index i = 0; i < program_.classes.size(); ++i) {
+      const ClassEntry &entry = program_.classes[i];
+      if (!IsName(entry.name)
+          || (entry.parent != kNoIndex && entry.parent >= i)
+          || entry.first_method > program_.methods.size()
+          || entry.method_count
+              > program_.methods.size() - entry.first_method) {
+        return false;
+      }
+    }
+    for (const MethodEntry &method : program_.methods) {
+      if (!IsName(method.name) || !IsNameList(method.params)
+          || method.body >= nodes) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  bool ValidNode(Index node) const {
+    const auto &[a, b, c] = program_.operands[node];
+    auto child = [node](Index index) {
+      return index < node;
+    };
+    auto variable = [&](Index index) {
+      return child(index) && program_.kinds[index] == Kind::kVariable;
+    };
+
+    switch (program_.kinds[node]) {
+      case Kind::kNumber:
+      case Kind::kString:
+      case Kind::kBool:
+        return a < program_.constants.size();
+      case Kind::kNone:
+        return true;
+      case Kind::kVariable:
+        return IsName(a) && (b == kNoIndex || IsName(b));
+      case Kind::kAssignment:
+        return IsName(a) && child(b);
+      case Kind::kFieldAssignment:
+        return variable(a) && IsName(b) && child(c);
+      case Kind::kPrint:
+      case Kind::kCompound:
+        return IsNodeList(a, node);
+      case Kind::kMethodCall:
+        return variable(a) && IsName(b) && IsNodeList(c, node);
+      case Kind::kNewInstance:
+        return a < program_.classes.size() && IsNodeList(b, node);
+      case Kind::kStringify:
+      case Kind::kNot:
+      case Kind::kReturn:
+        return child(a);
+      case Kind::kAdd:
+      case Kind::kSub:
+      case Kind::kMult:
+      case Kind::kDiv:
+      case Kind::kOr:
+      case Kind::kAnd:
+        return child(a) && child(b);
+      case Kind::kClassDefinition:
+        return a < program_.classes.size();
+      case Kind::kIfElse:
+        return child(a) && child(b) && (c == kNoIndex || child(c));
+      case Kind::kComparison:
+        return child(a) && child(b)
+            && c <= static_cast<Index>(CompareOp::kGreaterOrEqual);
+    }
+    return false;
+  }
+
+  bool IsName(Index index) const {
+    return index < program_.names.size();
+  }
+
+  bool IsList(Index list) const {
+    const auto &lists = program_.lists;
+    return list < lists.size() && lists[list] < lists.size() - list;
+  }
+
+  bool IsNameList(Index list) const {
+    if (!IsList(list)) {
+      return false;
+    }
+    for (Index i = 1; i <= program_.lists[list]; ++i) {
+      if (!IsName(program_.lists[list + i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool IsNodeList(Index list, Index parent) const {
+    if (!IsList(list)) {
+      return false;
+    }
+    for (Index i = 1; i <= program_.lists[list]; ++i) {
+      if (program_.lists[list + i] >= parent) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const Program &program_;
+};
+
+} /* namespace */
+
+uint64_t SourceHash(string_view text) {
+  return Hash(text);
+}
+
+void SaveProgram(const Program &program, uint64_t source_hash,
+                 const string &path) {
+  string blob;
+  auto slice = [&blob](string_view text) {
+    NameEntry entry{static_cast<uint32_t>(blob.size()),
+                    static_cast<uint32_t>(text.size())};
+    blob.append(text);
+    return entry;
+  };
+
+  vector<NameEntry> names;
+  names.reserve(program.names.size());
+  for (string_view name : program.names) {
+    names.push_back(slice(name));
+  }
+
+  vector<ConstantEntry> constants;
+  constants.reserve(program.constants.size());
+  for (const ObjectHolder &constant : program.constants) {
+    if (auto number = constant.TryAs<Runtime::Number>()) {
+      constants.push_back({ConstantType::kNumber,
+                           static_cast<uint32_t>(number->GetValue()), 0});
+    } else if (auto str = constant.TryAs<Runtime::String>()) {
+      NameEntry entry = slice(str->GetValue());
+      constants.push_back({ConstantType::kString, entry.offset, entry.size});
+    } else if (auto boolean = constant.TryAs<Runtime::Bool>()) {
+      constants.push_back({ConstantType::kBool,
+                           static_cast<uint32_t>(boolean->GetValue()), 0});
+    } else {
+      throw runtime_error("Can't cache a constant of unknown type");
+    }
+  }
+
+  string payload;
+  Append(payload, program.operands);
+  Append(payload, program.lists);
+  Append(payload, program.classes);
+  Append(payload, program.methods);
+  Append(payload, names);
+  Append(payload, constants);
+  Append(payload, program.kinds);
+  payload.append(blob);
+
+  Header header{};
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.byte_order = kByteOrder;
+  header.source_hash = source_hash;
+  header.checksum = Hash(payload);
+  header.node_count = static_cast<uint32_t>(program.NodeCount());
+  header.list_size = static_cast<uint32_t>(program.lists.size());
+  header.name_count = static_cast<uint32_t>(names.size());
+  header.constant_count = static_cast<uint32_t>(constants.size());
+  header.class_count = static_cast<uint32_t>(program.classes.size());
+  header.method_count = static_cast<uint32_t>(program.methods.size());
+  header.root = program.root;
+  header.blob_size = static_cast<uint32_t>(blob.size());
+
+  string temp_path = path + ".tmp."
+      + to_string(chrono::steady_clock::now().time_since_epoch().count());
+  {
+    ofstream output(temp_path, ios::binary | ios::trunc);
+    output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    output.write(payload.data(), static_cast<streamsize>(payload.size()));
+    if (!output.flush()) {
+      output.close();
+      remove(temp_path.c_str());
+      throw runtime_error("Can't write " + temp_path);
+    }
+  }
+  error_code error;
+  filesystem::rename(temp_path, path, error);
+  if (error) {
+    remove(temp_path.c_str());
+    throw runtime_error("Can't replace " + path + ": " + error.message());
+  }
+}
+
+unique_ptr<Program> LoadProgram(const string &path, uint64_t source_hash) {
+  if (!filesystem::is_regular_file(path)) {
+    return nullptr;
+  }
+  shared_ptr<const Parse::SourceBuffer> file;
+  try {
+    file = Parse::SourceBuffer::MapFile(path);
+  } catch (const runtime_error &) {
+    return nullptr;
+  }
+
+  string_view data = file->Text();
+  Header header;
+  if (data.size() < sizeof(header)) {
+    return nullptr;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  string_view payload = data.substr(sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0
+      || header.version != kVersion || header.byte_order != kByteOrder
+      || header.source_hash != source_hash
+      || payload.size() != PayloadSize(header)
+      || Hash(payload) != header.checksum) {
+    return nullptr;
+  }
+
+  auto program = make_unique<Program>();
+  vector<NameEntry> names;
+  vector<ConstantEntry> constants;
+  Reader reader(payload.data());
+  reader.Read(program->operands, header.node_count);
+  reader.Read(program->lists, header.list_size);
+  reader.Read(program->classes, header.class_count);
+  reader.Read(program->methods, header.method_count);
+  reader.Read(names, header.name_count);
+  reader.Read(constants, header.constant_count);
+  reader.Read(program->kinds, header.node_count);
+  string_view blob(reader.Position(), header.blob_size);
+  program->root = header.root;
+
+  auto in_blob = [&blob](uint32_t offset, uint32_t size) {
+    return offset <= blob.size() && size <= blob.size() - offset;
+  };
+
+  program->names.reserve(names.size());
+  for (const NameEntry &name : names) {
+    if (!in_blob(name.offset, name.size)) {
+      return nullptr;
+    }
+    program->names.push_back(blob.substr(name.offset, name.size));
+  }
+
+  program->constants.reserve(constants.size());
+  for (const ConstantEntry &constant : constants) {
+    switch (constant.type) {
+      case ConstantType::kNumber:
+        program->constants.push_back(ObjectHolder::Own(
+            Runtime::Number(static_cast<int>(constant.value))));
+        break;
+      case ConstantType::kString:
+        if (!in_blob(constant.value, constant.size)) {
+          return nullptr;
+        }
+        program->constants.push_back(ObjectHolder::Own(Runtime::String(
+            string(blob.substr(constant.value, constant.size)))));
+        break;
+      case ConstantType::kBool:
+        program->constants.push_back(
+            ObjectHolder::Own(Runtime::Bool(constant.value != 0)));
+        break;
+      default:
+        return nullptr;
+    }
+  }
+
+  if (!Validator(*program).Valid()) {
+    return nullptr;
+  }
+  program->storage = std::move(file);
+  return program;
+}
+
+string CachePath(const string &cache_dir, uint64_t source_hash) {
+  char name[24];
+  snprintf(name, sizeof(name), "%016llx.myc",
+           static_cast<unsigned long long>(source_hash));
+  return (filesystem::path(cache_dir) / name).string();
+}
+
+unique_ptr<Program> LoadOrParse(shared_ptr<const Parse::SourceBuffer> source,
+                                const string &cache_dir) {
+  uint64_t hash = SourceHash(source->Text());
+  string path = CachePath(cache_dir, hash);
+  if (auto program = LoadProgram(path, hash)) {
+    return program;
+  }
+
+  Parse::Lexer lexer(std::move(source));
+  auto program = ParseFlatProgram(lexer);
+  try {
+    filesystem::create_directories(cache_dir);
+    SaveProgram(*program, hash, path);
+  } catch (const runtime_error &) {
+    // The cache only saves time; a read-only or full disk must not stop the
+    // program from running.
+  }
+  return program;
+}
+
+} /* namespace Flat */
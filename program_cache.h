@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace Parse {
+class SourceBuffer;
+}
+
+namespace Flat {
+
+struct Program;
+
+// On-disk form of a Flat::Program. The file holds the node, list, class and
+// method tables as they are in memory, followed by the names and literals, and
+// is tagged with a hash of the source it was parsed from. Loading maps the
+// file, validates it, copies the tables and rebuilds the constant objects;
+// names are not copied, they point into the mapping.
+
+uint64_t SourceHash(std::string_view text);
+
+// Writes to a temporary file next to path and renames it into place, so
+// readers never see a partial file. Throws std::runtime_error on I/O errors.
+void SaveProgram(const Program &program, uint64_t source_hash,
+                 const std::string &path);
+
+// Returns nullptr if the file is missing, was written for other source (or
+// by an incompatible build), or fails validation.
+std::unique_ptr<Program> LoadProgram(const std::string &path,
+                                     uint64_t source_hash);
+
+// Name of the cache file for source with the given hash inside cache_dir.
+std::string CachePath(const std::string &cache_dir, uint64_t source_hash);
+
+// Loads the program for source from cache_dir, or parses it and refreshes the
+// cache. Failing to write the cache is not an error; ParseError still is.
+std::unique_ptr<Program> LoadOrParse(
+    std::shared_ptr<const Parse::SourceBuffer> source,
+    const std::string &cache_dir);
+
+} /* namespace Flat */
@@ -0,0 +1,99 @@
+#include "region.h"
+
+#include <algorithm>
+#include <iterator>
+
+using namespace std;
+
+namespace Runtime {
+
+namespace Slab {
+
+void *AllocateIn(Region &region, size_t size) {
+  return region.Allocate(size);
+}
+
+void FreeIn(Region &region, void *pointer, size_t size) {
+  region.Free(pointer, size);
+}
+
+} /* namespace Slab */
+
+Region::~Region() {
+  if (live_ != 0) {
+    GiveToSlabs();
+  }
+  for (Slab::Chunk *chunk : chunks_) {
+    if (chunk->live == 0) {
+      Slab::ReleaseChunk(chunk);
+    } else {
+      chunk->region = nullptr;
+    }
+  }
+}
+
+void Region::GiveToSlabs() {
+  // Free blocks of the chunks that are released go with them.
+  for (size_t i = 0; i < size(free_lists_); ++i) {
+    while (Slab::Block *block = free_lists_[i]) {
+      free_lists_[i] = block->next;
+      if (Slab::ChunkOf(block).live != 0) {
+        block->next = Slab::free_lists[i];
+        Slab::free_lists[i] = block;
+      }
+    }
+  }
+  if (chunks_.empty() || chunks_.back()->live == 0) {
+    return;
+  }
+  // The unused end of the last chunk, in blocks as large as they come.
+  while (static_cast<size_t>(end_ - next_) >= Slab::kGranule) {
+    size_t size = min(static_cast<size_t>(end_ - next_), Slab::kMaxBlock)
+        & ~(Slab::kGranule - 1);
+    auto *block = reinterpret_cast<Slab::Block *>(next_);
+    Slab::Block *&head = Slab::free_lists[Slab::ClassOf(size)];
+    block->next = head;
+    head = block;
+    next_ += size;
+  }
+}
+
+Region::Scope::Scope(Region *region) : previous_(Slab::active_region) {
+  Slab::active_region = region;
+}
+
+Region::Scope::~Scope() {
+  Slab::active_region = previous_;
+}
+
+void *Region::Allocate(size_t size) {
+  ++live_;
+  Slab::Block *&head = free_lists_[Slab::ClassOf(size)];
+  if (Slab::Block *block = head) {
+    head = block->next;
+    ++Slab::ChunkOf(block).live;
+    return block;
+  }
+  size = (Slab::ClassOf(size) + 1) * Slab::kGranule;
+  if (static_cast<size_t>(end_ - next_) < size) {
+    Slab::Chunk *chunk = Slab::NewChunk(this);
+    chunks_.push_back(chunk);
+    next_ = reinterpret_cast<char *>(chunk) + sizeof(Slab::Chunk);
+    end_ = reinterpret_cast<char *>(chunk) + Slab::kChunkSize;
+  }
+  ++chunks_.back()->live;
+  void *block = next_;
+  next_ += size;
+  return block;
+}
+
+void Region::Free(void *pointer, size_t size) {
+  --live_;
+  --Slab::ChunkOf(pointer).live;
+  auto *block = static_cast<Slab::Block *>(pointer);
+  Slab::Block *&head = free_lists_[Slab::ClassOf(size)];
+  block->next = head;
+  head = block;
+}
+
+} /* namespace Runtime */
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "slab.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace Runtime {
+
+// Memory for the objects made while it is active on a thread: the blocks
+// SlabAllocator hands out (objects with their reference counts, closure
+// entries) are bumped off its chunks, and a freed one is only kept for the
+// region's next block of its size. The chunks go all at once with the
+// region; nothing in them is given back one by one.
+//
+// Objects in a region are still destroyed one by one, since strings and
+// closures own memory elsewhere; only the chunks go at once. Blocks should
+// all be freed before the region goes. The chunks of those still alive are
+// kept as slabs: their free blocks join the slab lists of the thread, and so
+// do the survivors when they are freed.
+class Region {
+ public:
+  Region() = default;
+  ~Region();
+
+  Region(const Region &) = delete;
+  Region &operator=(const Region &) = delete;
+
+  // Makes region the active one of the thread while alive; null suspends the
+  // active region, for objects that must outlive it.
+  class Scope {
+   public:
+    explicit Scope(Region *region);
+    ~Scope();
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+   private:
+    Region *previous_;
+  };
+
+  void *Allocate(size_t size);
+  void Free(void *pointer, size_t size);
+
+  // Blocks allocated and not yet freed.
+  size_t Live() const {
+    return live_;
+  }
+
+  size_t Bytes() const {
+    return chunks_.size() * Slab::kChunkSize;
+  }
+
+ private:
+  // Hands the free blocks of the chunks with survivors to the slabs.
+  void GiveToSlabs();
+
+  std::vector<Slab::Chunk *> chunks_;
+  Slab::Block *free_lists_[Slab::kMaxBlock / Slab::kGranule] = {};
+  char *next_ = nullptr;
+  char *end_ = nullptr;
+  size_t live_ = 0;
+};
+
+} /* namespace Runtime */
@@ -0,0 +1,260 @@
+#include "scan.h"
+
+#include <atomic>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define MYTHON_SCAN_X86 1
+#endif
+
+namespace Parse::Scan {
+
+namespace {
+
+bool IsSpace(char c) {
+  return c == ' ';
+}
+
+bool IsWhitespace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+bool IsIdentifier(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+      || (c >= '0' && c <= '9') || c == '_';
+}
+
+const char *ScalarSkipSpaces(const char *pos, const char *end) {
+  while (pos != end && IsSpace(*pos)) ++pos;
+  return pos;
+}
+
+const char *ScalarSkipWhitespace(const char *pos, const char *end) {
+  while (pos != end && IsWhitespace(*pos)) ++pos;
+  return pos;
+}
+
+const char *ScalarSkipIdentifier(const char *pos, const char *end) {
+  while (pos != end && IsIdentifier(*pos)) ++pos;
+  return pos;
+}
+
+const char *ScalarFindChar(const char *pos, const char *end, char c) {
+  while (pos != end && *pos != c) ++pos;
+  return pos;
+}
+
+#ifdef MYTHON_SCAN_X86
+
+// Bytes are compared as signed, so everything >= 0x80 falls outside every
+// ASCII range below, just like in the scalar predicates.
+
+__m128i InRange16(__m128i v, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+__m128i SpaceMask16(__m128i v) {
+  return _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+}
+
+__m128i WhitespaceMask16(__m128i v) {
+  return _mm_or_si128(SpaceMask16(v), InRange16(v, '\t', '\r'));
+}
+
+__m128i IdentifierMask16(__m128i v) {
+  __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  return _mm_or_si128(
+      _mm_or_si128(InRange16(lower, 'a', 'z'), InRange16(v, '0', '9')),
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+// Skips while Mask(block) has every byte set, then finishes with Scalar.
+template<typename Mask, typename Scalar>
+const char *Sse2Skip(const char *pos, const char *end, Mask mask,
+                     Scalar scalar) {
+  while (end - pos >= 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+    auto bits = static_cast<unsigned>(_mm_movemask_epi8(mask(block)));
+    if (bits != 0xFFFF) {
+      return pos + __builtin_ctz(~bits);
+    }
+    pos += 16;
+  }
+  return scalar(pos, end);
+}
+
+const char *Sse2SkipSpaces(const char *pos, const char *end) {
+  return Sse2Skip(pos, end, SpaceMask16, ScalarSkipSpaces);
+}
+
+const char *Sse2SkipWhitespace(const char *pos, const char *end) {
+  return Sse2Skip(pos, end, WhitespaceMask16, ScalarSkipWhitespace);
+}
+
+const char *Sse2SkipIdentifier(const char *pos, const char *end) {
+  return Sse2Skip(pos, end, IdentifierMask16, ScalarSkipIdentifier);
+}
+
+const char *Sse2FindChar(const char *pos, const char *end, char c) {
+  __m128i needle = _mm_set1_epi8(c);
+  while (end - pos >= 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+    auto bits = static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+    if (bits != 0) {
+      return pos + __builtin_ctz(bits);
+    }
+    pos += 16;
+  }
+  return ScalarFindChar(pos, end, c);
+}
+
+#define MYTHON_AVX2 __attribute__((target("avx2")))
+
+MYTHON_AVX2 __m256i InRange32(__m256i v, char lo, char hi) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                          _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+MYTHON_AVX2 __m256i SpaceMask32(__m256i v) {
+  return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+}
+
+MYTHON_AVX2 __m256i WhitespaceMask32(__m256i v) {
+  return _mm256_or_si256(SpaceMask32(v), InRange32(v, '\t', '\r'));
+}
+
+MYTHON_AVX2 __m256i IdentifierMask32(__m256i v) {
+  __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+  return _mm256_or_si256(
+      _mm256_or_si256(InRange32(lower, 'a', 'z'), InRange32(v, '0', '9')),
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+}
+
+template<typename Mask, typename Tail>
+MYTHON_AVX2 const char *Avx2Skip(const char *pos, const char *end, Mask mask,
+                                 Tail tail) {
+  while (end - pos >= 32) {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pos));
+    auto bits = static_cast<unsigned>(_mm256_movemask_epi8(mask(block)));
+    if (bits != 0xFFFFFFFFu) {
+      return pos + __builtin_ctz(~bits);
+    }
+    pos += 32;
+  }
+  return tail(pos, end);
+}
+
+MYTHON_AVX2 const char *Avx2SkipSpaces(const char *pos, const char *end) {
+  return Avx2Skip(pos, end, SpaceMask32, Sse2SkipSpaces);
+}
+
+MYTHON_AVX2 const char *Avx2SkipWhitespace(const char *pos, const char *end) {
+  return Avx2Skip(pos, end, WhitespaceMask32, Sse2SkipWhitespace);
+}
+
+MYTHON_AVX2 const char *Avx2SkipIdentifier(const char *pos, const char *end) {
+  return Avx2Skip(pos, end, IdentifierMask32, Sse2SkipIdentifier);
+}
+
+MYTHON_AVX2 const char *Avx2FindChar(const char *pos, const char *end, char c) {
+  __m256i needle = _mm256_set1_epi8(c);
+  while (end - pos >= 32) {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pos));
+    auto bits = static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+    if (bits != 0) {
+      return pos + __builtin_ctz(bits);
+    }
+    pos += 32;
+  }
+  return Sse2FindChar(pos, end, c);
+}
+
+#undef MYTHON_AVX2
+
+#endif
+
+struct Kernels {
+  Kernel kind;
+  const char *(*skip_spaces)(const char *, const char *);
+  const char *(*skip_whitespace)(const char *, const char *);
+  const char *(*skip_identifier)(const char *, const char *);
+  const char *(*find_char)(const char *, const char *, char);
+};
+
+constexpr Kernels kScalarKernels{
+    Kernel::kScalar, ScalarSkipSpaces, ScalarSkipWhitespace,
+    ScalarSkipIdentifier, ScalarFindChar
+};
+
+#ifdef MYTHON_SCAN_X86
+constexpr Kernels kSse2Kernels{
+    Kernel::kSse2, Sse2SkipSpaces, Sse2SkipWhitespace, Sse2SkipIdentifier,
+    Sse2FindChar
+};
+
+constexpr Kernels kAvx2Kernels{
+    Kernel::kAvx2, Avx2SkipSpaces, Avx2SkipWhitespace, Avx2SkipIdentifier,
+    Avx2FindChar
+};
+#endif
+
+const Kernels *KernelsFor(Kernel kernel) {
+#ifdef MYTHON_SCAN_X86
+  switch (kernel) {
+    case Kernel::kAvx2:
+      if (__builtin_cpu_supports("avx2")) {
+        return &kAvx2Kernels;
+      }
+      [[fallthrough]];
+    case Kernel::kSse2:
+      return &kSse2Kernels;
+    case Kernel::kScalar:
+      break;
+  }
+#endif
+  return &kScalarKernels;
+}
+
+std::atomic<const Kernels *> &Active() {
+  static std::atomic<const Kernels *> active{KernelsFor(Kernel::kAvx2)};
+  return active;
+}
+
+const Kernels &Current() {
+  return *Active().load(std::memory_order_relaxed);
+}
+
+} /* namespace */
+
+Kernel BestKernel() {
+  return KernelsFor(Kernel::kAvx2)->kind;
+}
+
+Kernel ActiveKernel() {
+  return Current().kind;
+}
+
+void UseKernel(Kernel kernel) {
+  Active().store(KernelsFor(kernel), std::memory_order_relaxed);
+}
+
+const char *SkipSpaces(const char *pos, const char *end) {
+  return Current().skip_spaces(pos, end);
+}
+
+const char *SkipWhitespace(const char *pos, const char *end) {
+  return Current().skip_whitespace(pos, end);
+}
+
+const char *SkipIdentifier(const char *pos, const char *end) {
+  return Current().skip_identifier(pos, end);
+}
+
+const char *FindChar(const char *pos, const char *end, char c) {
+  return Current().find_char(pos, end, c);
+}
+
+} /* namespace Parse::Scan */
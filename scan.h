@@ -0,0 +1,31 @@
+#pragma once
+
+namespace Parse::Scan {
+
+// Character-class kernels used by the lexer. Each returns the first position
+// in [pos, end) that does not belong to the run (or end). The vector variants
+// look at 16 (SSE2) or 32 (AVX2) bytes at a time and never read past end.
+
+enum class Kernel {
+  kScalar,
+  kSse2,
+  kAvx2,
+};
+
+// Best kernel supported by the CPU, detected once at startup.
+Kernel BestKernel();
+Kernel ActiveKernel();
+// Switches every lexer in the process to the given kernel, e.g. to compare
+// against the scalar path. Falls back to the best supported one.
+void UseKernel(Kernel kernel);
+
+// ' '
+const char *SkipSpaces(const char *pos, const char *end);
+// ' ', '\t', '\n', '\v', '\f', '\r', the same set as isspace in the C locale
+const char *SkipWhitespace(const char *pos, const char *end);
+// [A-Za-z0-9_]
+const char *SkipIdentifier(const char *pos, const char *end);
+// Position of the first c
+const char *FindChar(const char *pos, const char *end, char c);
+
+} /* namespace Parse::Scan */
@@ -0,0 +1,26 @@
+#include "shape.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace Runtime {
+
+uint32_t Shape::IndexOf(Symbol name) const {
+  auto found = find(names_.begin(), names_.end(), name);
+  return found != names_.end() ? static_cast<uint32_t>(found - names_.begin())
+                               : kMissing;
+}
+
+const Shape &Shape::With(Symbol name) const {
+  lock_guard guard(mutex_);
+  unique_ptr<Shape> &child = transitions_[name];
+  if (!child) {
+    child = make_unique<Shape>();
+    child->names_ = names_;
+    child->names_.push_back(name);
+  }
+  return *child;
+}
+
+} /* namespace Runtime */
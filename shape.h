@@ -0,0 +1,49 @@
+#pragma once
+
+#include "symbol_table.h"
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace Runtime {
+
+// Layout of an instance's fields (a hidden class): their names in the order
+// they were added, each at the index of its value in the instance. Shapes
+// form a tree under the empty shape of each class; adding a field moves an
+// instance to a child, the same one for every instance of the class that
+// adds the same fields in the same order. Shapes live as long as the class.
+class Shape {
+ public:
+  static constexpr uint32_t kMissing = std::numeric_limits<uint32_t>::max();
+
+  Shape() = default;
+
+  Shape(const Shape &) = delete;
+  Shape &operator=(const Shape &) = delete;
+
+  size_t Size() const {
+    return names_.size();
+  }
+
+  std::span<const Symbol> Names() const {
+    return names_;
+  }
+
+  // Index of the field, or kMissing.
+  uint32_t IndexOf(Symbol name) const;
+  // This shape with name added as the last field. Safe to call from several
+  // threads at once.
+  const Shape &With(Symbol name) const;
+
+ private:
+  std::vector<Symbol> names_;
+  mutable std::mutex mutex_;
+  mutable std::unordered_map<Symbol, std::unique_ptr<Shape>> transitions_;
+};
+
+} /* namespace Runtime */
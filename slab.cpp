@@ -0,0 +1,114 @@
+#include "slab.h"
+
+#include <mutex>
+#include <utility>
+
+using namespace std;
+
+namespace Runtime {
+namespace Slab {
+
+namespace {
+constexpr size_t kClasses = kMaxBlock / kGranule;
+// Released chunks a thread keeps for reuse, sparing a run in a region the
+// cost of mapping fresh memory.
+constexpr size_t kMaxSpareChunks = 64;
+
+struct SpareChunk {
+  SpareChunk *next;
+};
+
+thread_local SpareChunk *spare_chunks;
+thread_local size_t spare_chunk_count;
+
+// Free blocks of the threads that have ended, for any thread to take.
+struct Orphans {
+  mutex lock;
+  Block *lists[kClasses] = {};
+};
+
+// Never destroyed: threads may still end after static destruction starts.
+Orphans &GetOrphans() {
+  static Orphans *orphans = new Orphans;
+  return *orphans;
+}
+
+// Hands the free lists of a thread over to the orphans when it ends, and
+// frees its spare chunks.
+struct ThreadLists {
+  ~ThreadLists() {
+    while (SpareChunk *chunk = spare_chunks) {
+      spare_chunks = chunk->next;
+      ::operator delete(chunk, align_val_t(kChunkSize));
+    }
+
+    Orphans &orphans = GetOrphans();
+    lock_guard guard(orphans.lock);
+    for (size_t i = 0; i < kClasses; ++i) {
+      Block *list = exchange(free_lists[i], nullptr);
+      if (!list) {
+        continue;
+      }
+      Block *last = list;
+      while (last->next) {
+        last = last->next;
+      }
+      last->next = orphans.lists[i];
+      orphans.lists[i] = list;
+    }
+  }
+};
+
+thread_local ThreadLists thread_lists;
+}
+
+Chunk *NewChunk(Region *region) {
+  // Makes sure this thread's lists are handed over when it ends.
+  [[maybe_unused]] ThreadLists &lists = thread_lists;
+
+  void *memory;
+  if (SpareChunk *chunk = spare_chunks) {
+    spare_chunks = chunk->next;
+    --spare_chunk_count;
+    memory = chunk;
+  } else {
+    memory = ::operator new(kChunkSize, align_val_t(kChunkSize));
+  }
+  return new (memory) Chunk{region, 0};
+}
+
+void ReleaseChunk(Chunk *chunk) {
+  if (spare_chunk_count == kMaxSpareChunks) {
+    ::operator delete(chunk, align_val_t(kChunkSize));
+    return;
+  }
+  spare_chunks = new (chunk) SpareChunk{spare_chunks};
+  ++spare_chunk_count;
+}
+
+void *Refill(size_t size_class) {
+  Block *&head = free_lists[size_class];
+  {
+    Orphans &orphans = GetOrphans();
+    lock_guard guard(orphans.lock);
+    head = exchange(orphans.lists[size_class], nullptr);
+  }
+  if (!head) {
+    size_t size = (size_class + 1) * kGranule;
+    auto *slab = reinterpret_cast<char *>(NewChunk(nullptr));
+    size_t blocks = (kChunkSize - sizeof(Chunk)) / size;
+    for (size_t offset = sizeof(Chunk) + blocks * size;
+         offset != sizeof(Chunk);) {
+      offset -= size;
+      auto *block = reinterpret_cast<Block *>(slab + offset);
+      block->next = head;
+      head = block;
+    }
+  }
+  Block *block = head;
+  head = block->next;
+  return block;
+}
+
+} /* namespace Slab */
+} /* namespace Runtime */
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace Runtime {
+
+class Region;
+
+// Blocks of the small fixed sizes runtime objects come in, handed out from
+// free lists of the calling thread: one list per size class, a multiple of
+// kGranule bytes up to kMaxBlock. An empty list is refilled from a fresh
+// slab, or from the blocks a finished thread left behind. Slabs are never
+// given back, and a block freed on another thread joins that thread's lists.
+//
+// While a Region is active on the thread, blocks come from it instead.
+namespace Slab {
+
+inline constexpr size_t kGranule = 16;
+inline constexpr size_t kMaxBlock = 256;
+// Size and alignment of slabs and region chunks, which start with a Chunk.
+inline constexpr size_t kChunkSize = 64 * 1024;
+
+struct Block {
+  Block *next;
+};
+
+struct alignas(kGranule) Chunk {
+  // Null for a slab.
+  Region *region;
+  // Blocks of the region allocated from the chunk and not yet freed.
+  uint32_t live;
+};
+
+// Plain pointers, so the fast path needs no thread_local initialization.
+inline thread_local Block *free_lists[kMaxBlock / kGranule];
+inline thread_local Region *active_region;
+
+constexpr size_t ClassOf(size_t size) {
+  return (size - 1) / kGranule;
+}
+
+inline Chunk &ChunkOf(void *block) {
+  return *reinterpret_cast<Chunk *>(reinterpret_cast<uintptr_t>(block)
+                                    & ~(kChunkSize - 1));
+}
+
+// A chunk of kChunkSize bytes owned by region, and back to be reused.
+Chunk *NewChunk(Region *region);
+void ReleaseChunk(Chunk *chunk);
+// The first block of a refilled list.
+void *Refill(size_t size_class);
+void *AllocateIn(Region &region, size_t size);
+void FreeIn(Region &region, void *pointer, size_t size);
+
+inline void *Allocate(size_t size) {
+  if (Region *region = active_region) {
+    return AllocateIn(*region, size);
+  }
+  Block *&head = free_lists[ClassOf(size)];
+  if (Block *block = head) {
+    head = block->next;
+    return block;
+  }
+  return Refill(ClassOf(size));
+}
+
+inline void Free(void *pointer, size_t size) {
+  if (Region *region = ChunkOf(pointer).region) {
+    FreeIn(*region, pointer, size);
+    return;
+  }
+  auto *block = static_cast<Block *>(pointer);
+  Block *&head = free_lists[ClassOf(size)];
+  block->next = head;
+  head = block;
+}
+
+} /* namespace Slab */
+
+// Standard allocator taking single objects of up to Slab::kMaxBlock bytes
+// from the slabs and anything else from operator new. Used with
+// std::allocate_shared, it puts an object and its control block in one block.
+template<typename T>
+class SlabAllocator {
+ public:
+  using value_type = T;
+
+  SlabAllocator() = default;
+
+  template<typename U>
+  SlabAllocator(const SlabAllocator<U> &) {
+  }
+
+  T *allocate(size_t n) {
+    if (n == 1 && kSlabbed) {
+      return static_cast<T *>(Slab::Allocate(sizeof(T)));
+    }
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T *pointer, size_t n) {
+    if (n == 1 && kSlabbed) {
+      Slab::Free(pointer, sizeof(T));
+    } else {
+      ::operator delete(pointer);
+    }
+  }
+
+  template<typename U>
+  bool operator==(const SlabAllocator<U> &) const {
+    return true;
+  }
+
+ private:
+  static constexpr bool kSlabbed = sizeof(T) <= Slab::kMaxBlock
+      && alignof(T) <= Slab::kGranule;
+};
+
+} /* namespace Runtime */
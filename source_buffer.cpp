@@ -0,0 +1,76 @@
+#include "source_buffer.h"
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MYTHON_HAS_MMAP 1
+#endif
+
+using namespace std;
+
+namespace Parse {
+
+shared_ptr<const SourceBuffer> SourceBuffer::MapFile(const string &path) {
+#ifdef MYTHON_HAS_MMAP
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw runtime_error("Can't open " + path);
+  }
+  struct stat st{};
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw runtime_error("Can't stat " + path);
+  }
+
+  shared_ptr<SourceBuffer> result(new SourceBuffer);
+  if (st.st_size > 0) {
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      throw runtime_error("Can't map " + path);
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    result->mapping_ = data;
+    result->mapping_size_ = st.st_size;
+    result->text_ = string_view(static_cast<const char *>(data), st.st_size);
+  }
+  close(fd);
+  return result;
+#else
+  ifstream input(path, ios::binary);
+  if (!input) {
+    throw runtime_error("Can't open " + path);
+  }
+  return FromStream(input);
+#endif
+}
+
+shared_ptr<const SourceBuffer> SourceBuffer::FromStream(istream &input) {
+  ostringstream contents;
+  contents << input.rdbuf();
+  return FromString(std::move(contents).str());
+}
+
+shared_ptr<const SourceBuffer> SourceBuffer::FromString(string text) {
+  shared_ptr<SourceBuffer> result(new SourceBuffer);
+  result->owned_ = std::move(text);
+  result->text_ = result->owned_;
+  return result;
+}
+
+SourceBuffer::~SourceBuffer() {
+#ifdef MYTHON_HAS_MMAP
+  if (mapping_) {
+    munmap(mapping_, mapping_size_);
+  }
+#endif
+}
+
+} /* namespace Parse */
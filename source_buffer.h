@@ -0,0 +1,37 @@
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace Parse {
+
+// Contiguous, immutable program text. The lexer scans it in place, so tokens
+// may refer to it for as long as the buffer is alive.
+class SourceBuffer {
+ public:
+  // Maps the file into memory (falls back to reading it on platforms without
+  // mmap). Throws std::runtime_error if the file can't be opened.
+  static std::shared_ptr<const SourceBuffer> MapFile(const std::string &path);
+  static std::shared_ptr<const SourceBuffer> FromStream(std::istream &input);
+  static std::shared_ptr<const SourceBuffer> FromString(std::string text);
+
+  SourceBuffer(const SourceBuffer &) = delete;
+  SourceBuffer &operator=(const SourceBuffer &) = delete;
+  ~SourceBuffer();
+
+  std::string_view Text() const {
+    return text_;
+  }
+
+ private:
+  SourceBuffer() = default;
+
+  std::string owned_;
+  void *mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  std::string_view text_;
+};
+
+} /* namespace Parse */
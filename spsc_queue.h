@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace Parse {
+
+// Bounded lock-free queue between exactly one producer thread and one consumer
+// thread. Pushed items become visible to the consumer in batches, at Publish
+// (or when the queue fills up), so the shared indices are touched once per
+// batch rather than once per item. Either side blocks while it can't make
+// progress; the consumer can Close the queue to release a blocked producer.
+template<typename T, size_t Capacity>
+class SpscQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+ public:
+  // Producer: queues an item, waiting for room. False (dropping the item) once
+  // the consumer has closed the queue; that is noticed when the queue looks
+  // full, i.e. within Capacity pushes.
+  bool Push(T item) {
+    if (tail_ - head_cache_ == Capacity) {
+      Publish();
+      size_t head;
+      while (tail_ - (head = head_.load(std::memory_order_acquire))
+          == Capacity) {
+        if (closed_.load(std::memory_order_relaxed)) {
+          return false;
+        }
+        head_.wait(head, std::memory_order_acquire);
+      }
+      if (closed_.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      head_cache_ = head;
+    }
+    slots_[tail_ & kMask] = std::move(item);
+    ++tail_;
+    return true;
+  }
+
+  // Producer: makes the items pushed so far visible to the consumer.
+  void Publish() {
+    if (published_tail_.load(std::memory_order_relaxed) != tail_) {
+      published_tail_.store(tail_, std::memory_order_release);
+      published_tail_.notify_one();
+    }
+  }
+
+  // Consumer: takes the next published item, waiting for one.
+  T Pop() {
+    if (head_local_ == tail_cache_) {
+      while ((tail_cache_ = published_tail_.load(std::memory_order_acquire))
+          == head_local_) {
+        published_tail_.wait(head_local_, std::memory_order_acquire);
+      }
+    }
+    T item = std::move(slots_[head_local_ & kMask]);
+    ++head_local_;
+    // Hand the slot back right away only if the producer may be waiting
+    // for it; otherwise once per batch.
+    if ((head_local_ & (kReleaseBatch - 1)) == 0
+        || head_local_ == tail_cache_) {
+      head_.store(head_local_, std::memory_order_release);
+      head_.notify_one();
+    }
+    return item;
+  }
+
+  // Consumer: drops whatever is queued; the producer's pending and later
+  // pushes fail.
+  void Close() {
+    closed_.store(true, std::memory_order_relaxed);
+    head_local_ = published_tail_.load(std::memory_order_acquire);
+    // A producer waiting for room sees head_ change and then the flag.
+    head_.store(head_local_ + Capacity, std::memory_order_release);
+    head_.notify_one();
+  }
+
+ private:
+  static constexpr size_t kMask = Capacity - 1;
+  static constexpr size_t kReleaseBatch = Capacity / 8 ? Capacity / 8 : 1;
+  static constexpr size_t kLine = 64;
+
+  std::array<T, Capacity> slots_;
+
+  // Written by the consumer.
+  alignas(kLine) std::atomic<size_t> head_ = 0;
+  std::atomic<bool> closed_ = false;
+  // Consumer-only.
+  alignas(kLine) size_t head_local_ = 0;
+  size_t tail_cache_ = 0;
+
+  // Written by the producer.
+  alignas(kLine) std::atomic<size_t> published_tail_ = 0;
+  // Producer-only.
+  alignas(kLine) size_t tail_ = 0;
+  size_t head_cache_ = 0;
+};
+
+} /* namespace Parse */
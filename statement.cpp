@@ -1,305 +1,274 @@
-#include "statement.h"
-#include "object.h"
-
-#include <iostream>
-#include <sstream>
-
-using namespace std;
-
-namespace Ast {
-
-using Runtime::Closure;
-
-ObjectHolder Assignment::Execute(Closure &closure) {
-  return closure[var_name] = right_value->Execute(closure);
-}
-
-Assignment::Assignment(string var, unique_ptr<Statement> rv) {
-  var_name = std::move(var);
-  right_value = std::move(rv);
-}
-
-VariableValue::VariableValue(string var_name) {
-  dotted_ids.push_back(std::move(var_name));
-}
-
-VariableValue::VariableValue(vector<string> dotted_ids) {
-  this->dotted_ids = std::move(dotted_ids);
-}
-
-ObjectHolder VariableValue::Execute(Closure &closure) {
-  if (closure.find(dotted_ids[0]) == closure.end())
-    throw std::runtime_error("No such variable!");
-
-  if (dotted_ids.size() == 1) {
-    return closure[dotted_ids[0]];
-  }
-  auto class_ = closure[dotted_ids[0]].TryAs<Runtime::ClassInstance>();
-  return class_->Fields()[dotted_ids[1]];
-}
-
-unique_ptr<Print> Print::Variable(string var) {
-  return make_unique<Print>(make_unique<VariableValue>(std::move(var)));
-}
-
-Print::Print(unique_ptr<Statement> argument) {
-  args.push_back(std::move(argument));
-}
-
-Print::Print(vector<unique_ptr<Statement>> args) {
-  this->args = std::move(args);
-}
-
-ObjectHolder Print::Execute(Closure &closure) {
-  bool first = true;
-  for (auto &arg : args) {
-    if (!first) {
-      *output << ' ';
-    }
-    first = false;
-
-    auto value = arg->Execute(closure);
-    if (value) {
-      value->Print(*output);
-    } else {
-      *output << "None";
-    }
-  }
-  *output << '\n';
-
-  return ObjectHolder::None();
-}
-
-ostream *Print::output = &cout;
-
-void Print::SetOutputStream(ostream &output_stream) {
-  output = &output_stream;
-}
-
-MethodCall::MethodCall(
-    unique_ptr<Statement> object,
-    string method,
-    vector<unique_ptr<Statement>> args
-) {
-  this->object = std::move(object);
-  this->method = std::move(method);
-  this->args = std::move(args);
-}
-
-ObjectHolder MethodCall::Execute(Closure &closure) {
-  vector<ObjectHolder> act_args;
-  act_args.reserve(args.size());
-  for (auto &arg : args) {
-    act_args.push_back(arg->Execute(closure));
-  }
-
-  auto *this_class = object->Execute(closure).TryAs<Runtime::ClassInstance>();
-
-  return this_class->Call(method, act_args);
-}
-
-ObjectHolder Stringify::Execute(Closure &closure) {
-  ostringstream out;
-  argument->Execute(closure)->Print(out);
-  return ObjectHolder::Own(Runtime::String(out.str()));
-}
-
-ObjectHolder Add::Execute(Closure &closure) {
-  auto lhs_holder = lhs->Execute(closure);
-  auto rhs_holder = rhs->Execute(closure);
-  if (lhs_holder.TryAs<Runtime::Number>() &&
-      rhs_holder.TryAs<Runtime::Number>()) {
-    int lhs_val = lhs_holder.TryAs<Runtime::Number>()->GetValue();
-    int rhs_val = rhs_holder.TryAs<Runtime::Number>()->GetValue();
-    return ObjectHolder::Own(Runtime::Number(lhs_val + rhs_val));
-  } else if (lhs_holder.TryAs<Runtime::String>() &&
-      rhs_holder.TryAs<Runtime::String>()) {
-    std::string lhs_val = lhs_holder.TryAs<Runtime::String>()->GetValue();
-    std::string rhs_val = rhs_holder.TryAs<Runtime::String>()->GetValue();
-    return ObjectHolder::Own(Runtime::String(lhs_val + rhs_val));
-  } else if (lhs_holder.TryAs<Runtime::ClassInstance>()) {
-    auto lhs_ = lhs_holder.TryAs<Runtime::ClassInstance>();
-    if (lhs_->HasMethod("__add__", 1)) {
-      return lhs_->Call("__add__", {rhs_holder});
-    }
-  }
-
-  throw runtime_error("Bad addition");
-}
-
-ObjectHolder Sub::Execute(Closure &closure) {
-  auto lhs_holder = lhs->Execute(closure);
-  auto rhs_holder = rhs->Execute(closure);
-  if (lhs_holder.TryAs<Runtime::Number>() &&
-      rhs_holder.TryAs<Runtime::Number>()) {
-    auto lhs_val = lhs_holder.TryAs<Runtime::Number>()->GetValue();
-    auto rhs_val = rhs_holder.TryAs<Runtime::Number>()->GetValue();
-    return ObjectHolder::Own(Runtime::Number(lhs_val - rhs_val));
-  }
-
-  throw runtime_error("Bad subtraction");
-}
-
-ObjectHolder Mult::Execute(Runtime::Closure &closure) {
-  auto lhs_holder = lhs->Execute(closure);
-  auto rhs_holder = rhs->Execute(closure);
-  if (lhs_holder.TryAs<Runtime::Number>() &&
-      rhs_holder.TryAs<Runtime::Number>()) {
-    auto lhs_val = lhs_holder.TryAs<Runtime::Number>()->GetValue();
-    auto rhs_val = rhs_holder.TryAs<Runtime::Number>()->GetValue();
-    return ObjectHolder::Own(Runtime::Number(lhs_val * rhs_val));
-  }
-
-  throw runtime_error("Bad multiplication");
-}
-
-ObjectHolder Div::Execute(Runtime::Closure &closure) {
-  auto lhs_holder = lhs->Execute(closure);
-  auto rhs_holder = rhs->Execute(closure);
-  if (lhs_holder.TryAs<Runtime::Number>() &&
-      rhs_holder.TryAs<Runtime::Number>()) {
-    auto lhs_val = lhs_holder.TryAs<Runtime::Number>()->GetValue();
-    auto rhs_val = rhs_holder.TryAs<Runtime::Number>()->GetValue();
-    return ObjectHolder::Own(Runtime::Number(lhs_val / rhs_val));
-  }
-
-  throw runtime_error("Bad division");
-}
-
-ObjectHolder Compound::Execute(Closure &closure) {
-  for (auto &statement : statements) {
-    if (dynamic_cast<Return *>(statement.get()))
-      return statement->Execute(closure);
-
-    if (dynamic_cast<IfElse *>(statement.get()) ||
-        dynamic_cast<MethodCall *>(statement.get())) {
-      ObjectHolder result = statement->Execute(closure);
-      if (result) {
-        return result;
-      }
-    } else {
-      statement->Execute(closure);
-    }
-  }
-
-  return Runtime::ObjectHolder::None();
-}
-
-ObjectHolder Return::Execute(Closure &closure) {
-  return statement->Execute(closure);
-}
-
-ClassDefinition::ClassDefinition(ObjectHolder class_)
-    : class_name(class_.TryAs<Runtime::Class>()->GetName()),
-      cls(std::move(class_)) {}
-
-ObjectHolder ClassDefinition::Execute(Runtime::Closure &closure) {
-  closure[class_name] = cls;
-  return ObjectHolder::None();
-}
-
-FieldAssignment::FieldAssignment(
-    VariableValue object, string field_name, unique_ptr<Statement> rv
-)
-    : object(std::move(object)),
-      field_name(std::move(field_name)),
-      right_value(std::move(rv)) {
-}
-
-ObjectHolder FieldAssignment::Execute(Runtime::Closure &closure) {
-  auto this_class = object.Execute(closure).TryAs<Runtime::ClassInstance>();
-  auto &field = this_class->Fields()[field_name];
-  field = right_value->Execute(closure);
-  return field;
-}
-
-IfElse::IfElse(
-    unique_ptr<Statement> condition,
-    unique_ptr<Statement> if_body,
-    unique_ptr<Statement> else_body
-) {
-  this->condition = std::move(condition);
-  this->if_body = std::move(if_body);
-  this->else_body = std::move(else_body);
-}
-
-ObjectHolder IfElse::Execute(Runtime::Closure &closure) {
-  auto cond = condition->Execute(closure);
-
-  if (Runtime::IsTrue(cond)) {
-    return if_body->Execute(closure);
-  } else if (else_body) {
-    return else_body->Execute(closure);
-  }
-
-  return ObjectHolder::None();
-}
-
-ObjectHolder Or::Execute(Runtime::Closure &closure) {
-  ObjectHolder lhs_h = lhs->Execute(closure);
-  ObjectHolder rhs_h = rhs->Execute(closure);
-  if (!lhs_h) {
-    lhs_h = ObjectHolder::Own(Runtime::Bool(false));
-  }
-  if (!rhs_h) {
-    rhs_h = ObjectHolder::Own(Runtime::Bool(false));
-  }
-  return Runtime::ObjectHolder::Own(
-      Runtime::Bool(lhs_h->IsTrue() || rhs_h->IsTrue())
-  );
-}
-
-ObjectHolder And::Execute(Runtime::Closure &closure) {
-  ObjectHolder lhs_h = lhs->Execute(closure);
-  ObjectHolder rhs_h = rhs->Execute(closure);
-  if (!lhs_h) {
-    lhs_h = ObjectHolder::Own(Runtime::Bool(false));
-  }
-  if (!rhs_h) {
-    rhs_h = ObjectHolder::Own(Runtime::Bool(false));
-  }
-  return Runtime::ObjectHolder::Own(
-      Runtime::Bool(lhs_h->IsTrue() && rhs_h->IsTrue())
-  );
-}
-
-ObjectHolder Not::Execute(Runtime::Closure &closure) {
-  ObjectHolder arg = argument->Execute(closure);
-  if (!arg) arg = ObjectHolder::Own(Runtime::Bool{false});
-  return Runtime::ObjectHolder::Own(Runtime::Bool(!arg->IsTrue()));
-}
-
-Comparison::Comparison(
-    Comparator cmp, unique_ptr<Statement> lhs, unique_ptr<Statement> rhs
-)
-    : comparator(std::move(cmp)), left(std::move(lhs)), right(std::move(rhs)) {}
-
-ObjectHolder Comparison::Execute(Runtime::Closure &closure) {
-  return ObjectHolder::Own(Runtime::Bool{
-      comparator(left->Execute(closure), right->Execute(closure))
-  });
-}
-
-NewInstance::NewInstance(
-    const Runtime::Class &class_, vector<unique_ptr<Statement>> args
-)
-    : class_(class_), args(std::move(args)) {}
-
-NewInstance::NewInstance(const Runtime::Class &class_)
-    : NewInstance(class_, {}) {}
-
-ObjectHolder NewInstance::Execute(Runtime::Closure &closure) {
-  auto *new_instance = new Runtime::ClassInstance(class_);
-  if (new_instance->HasMethod("__init__", args.size())) {
-    std::vector<ObjectHolder> actual_args;
-    actual_args.reserve(args.size());
-    for (auto &statement : args) {
-      actual_args.push_back(statement->Execute(closure));
-    }
-    new_instance->Call("__init__", actual_args);
-  }
-
-  return ObjectHolder::Share(*new_instance);
-}
-
-} /* namespace Ast */
+#include "statement.h"
+#include "object.h"
+#include "operations.h"
+
+#include <array>
+#include <iostream>
+#include <span>
+#include <sstream>
+
+using namespace std;
+
+namespace Ast {
+
+using Runtime::Closure;
+
+namespace {
+// closure[name] without building a std::string key for names already there.
+ObjectHolder &Slot(Closure &closure, string_view name) {
+  if (auto it = closure.find(name); it != closure.end()) {
+    return it->second;
+  }
+  return closure.emplace(name, ObjectHolder{}).first->second;
+}
+
+// Values of a call's arguments: on the stack for the usual handful, on the
+// heap beyond that.
+class Arguments {
+ public:
+  Arguments(StatementList args, Closure &closure) {
+    span<ObjectHolder> values(inline_values_);
+    if (args.size() > inline_values_.size()) {
+      heap_values_.resize(args.size());
+      values = heap_values_;
+    }
+    values = values.first(args.size());
+    for (size_t i = 0; i < args.size(); ++i) {
+      values[i] = args[i]->Execute(closure);
+    }
+    values_ = values;
+  }
+
+  span<const ObjectHolder> Values() const {
+    return values_;
+  }
+
+ private:
+  array<ObjectHolder, 6> inline_values_;
+  vector<ObjectHolder> heap_values_;
+  span<const ObjectHolder> values_;
+};
+}
+
+ObjectHolder Assignment::Execute(Closure &closure) {
+  return Slot(closure, var_name) = right_value->Execute(closure);
+}
+
+Assignment::Assignment(string_view var, Statement *rv)
+    : Statement(Kind::kAssignment), var_name(var), right_value(rv) {
+}
+
+VariableValue::VariableValue(span<const string_view> dotted_ids)
+    : Statement(Kind::kVariableValue), dotted_ids(dotted_ids),
+      field(dotted_ids.size() > 1 ? Runtime::Intern(dotted_ids[1])
+                                  : Runtime::kNoSymbol) {
+}
+
+ObjectHolder VariableValue::Execute(Closure &closure) {
+  auto it = closure.find(dotted_ids[0]);
+  if (it == closure.end())
+    throw std::runtime_error("No such variable!");
+
+  if (dotted_ids.size() == 1) {
+    return it->second;
+  }
+  ObjectHolder *value = cache.Find(Runtime::AsInstance(it->second), field);
+  return value ? *value : ObjectHolder::None();
+}
+
+Print::Print(StatementList args) : Statement(Kind::kPrint), args(args) {
+}
+
+ObjectHolder Print::Execute(Closure &closure) {
+  bool first = true;
+  for (auto &arg : args) {
+    if (!first) {
+      *output << ' ';
+    }
+    first = false;
+
+    Runtime::PrintValue(arg->Execute(closure), *output);
+  }
+  *output << '\n';
+
+  return ObjectHolder::None();
+}
+
+ostream *Print::output = &cout;
+
+void Print::SetOutputStream(ostream &output_stream) {
+  output = &output_stream;
+}
+
+ostream &Print::OutputStream() {
+  return *output;
+}
+
+MethodCall::MethodCall(Statement *object, string_view method,
+                       StatementList args)
+    : Statement(Kind::kMethodCall), object(object), method(method),
+      selector(Runtime::Intern(method)), args(args) {
+}
+
+ObjectHolder MethodCall::Execute(Closure &closure) {
+  Arguments act_args(args, closure);
+
+  ObjectHolder receiver = object->Execute(closure);
+  Runtime::ClassInstance &this_class = Runtime::AsInstance(receiver);
+  auto *target = cache.Lookup(this_class.GetClass(), selector, stats);
+
+  return this_class.Call(
+      Runtime::CheckCall(target, selector, act_args.Values().size()),
+      act_args.Values());
+}
+
+Runtime::CacheStats MethodCall::stats;
+
+Runtime::CacheStats &MethodCall::Stats() {
+  return stats;
+}
+
+ObjectHolder Stringify::Execute(Closure &closure) {
+  return Runtime::Stringify(argument->Execute(closure));
+}
+
+ObjectHolder Add::Execute(Closure &closure) {
+  auto lhs_holder = lhs->Execute(closure);
+  return Runtime::Add(std::move(lhs_holder), rhs->Execute(closure));
+}
+
+ObjectHolder Sub::Execute(Closure &closure) {
+  auto lhs_holder = lhs->Execute(closure);
+  return Runtime::Sub(std::move(lhs_holder), rhs->Execute(closure));
+}
+
+ObjectHolder Mult::Execute(Runtime::Closure &closure) {
+  auto lhs_holder = lhs->Execute(closure);
+  return Runtime::Mult(std::move(lhs_holder), rhs->Execute(closure));
+}
+
+ObjectHolder Div::Execute(Runtime::Closure &closure) {
+  auto lhs_holder = lhs->Execute(closure);
+  return Runtime::Div(std::move(lhs_holder), rhs->Execute(closure));
+}
+
+Completion ExecuteStatement(Statement &statement, Closure &closure) {
+  switch (statement.kind) {
+    case Kind::kReturn:
+      return {statement.Execute(closure), true};
+    case Kind::kCompound:
+      return static_cast<Compound &>(statement).Run(closure);
+    case Kind::kIfElse:
+      return static_cast<IfElse &>(statement).Run(closure);
+    default:
+      statement.Execute(closure);
+      return {};
+  }
+}
+
+ObjectHolder Compound::Execute(Closure &closure) {
+  return Run(closure).value;
+}
+
+Completion Compound::Run(Closure &closure) {
+  for (auto &statement : statements) {
+    Completion completion = ExecuteStatement(*statement, closure);
+    if (completion.returned) {
+      return completion;
+    }
+  }
+  return {};
+}
+
+ObjectHolder Return::Execute(Closure &closure) {
+  return statement->Execute(closure);
+}
+
+ClassDefinition::ClassDefinition(const ObjectHolder &class_)
+    : Statement(Kind::kClassDefinition),
+      class_name(class_.TryAs<Runtime::Class>()->GetName()),
+      cls(class_) {}
+
+ObjectHolder ClassDefinition::Execute(Runtime::Closure &closure) {
+  Slot(closure, class_name) = cls;
+  return ObjectHolder::None();
+}
+
+FieldAssignment::FieldAssignment(
+    VariableValue object, string_view field_name, Statement *rv
+)
+    : Statement(Kind::kFieldAssignment), object(object),
+      field_name(field_name), field(Runtime::Intern(field_name)),
+      right_value(rv) {
+}
+
+ObjectHolder FieldAssignment::Execute(Runtime::Closure &closure) {
+  ObjectHolder receiver = object.Execute(closure);
+  // The value first: computing it may add fields and move the others.
+  ObjectHolder value = right_value->Execute(closure);
+  return cache.Get(Runtime::AsInstance(receiver), field) = std::move(value);
+}
+
+IfElse::IfElse(Statement *condition, Statement *if_body, Statement *else_body)
+    : Statement(Kind::kIfElse), condition(condition), if_body(if_body),
+      else_body(else_body) {
+}
+
+ObjectHolder IfElse::Execute(Runtime::Closure &closure) {
+  return Run(closure).value;
+}
+
+Completion IfElse::Run(Runtime::Closure &closure) {
+  auto cond = condition->Execute(closure);
+
+  if (Runtime::IsTrue(cond)) {
+    return ExecuteStatement(*if_body, closure);
+  } else if (else_body) {
+    return ExecuteStatement(*else_body, closure);
+  }
+
+  return {};
+}
+
+ObjectHolder Or::Execute(Runtime::Closure &closure) {
+  ObjectHolder lhs_h = lhs->Execute(closure);
+  return Runtime::Or(lhs_h, rhs->Execute(closure));
+}
+
+ObjectHolder And::Execute(Runtime::Closure &closure) {
+  ObjectHolder lhs_h = lhs->Execute(closure);
+  return Runtime::And(lhs_h, rhs->Execute(closure));
+}
+
+ObjectHolder Not::Execute(Runtime::Closure &closure) {
+  return Runtime::Not(argument->Execute(closure));
+}
+
+Comparison::Comparison(Comparator cmp, Statement *lhs, Statement *rhs)
+    : Statement(Kind::kComparison), comparator(cmp), left(lhs), right(rhs) {}
+
+ObjectHolder Comparison::Execute(Runtime::Closure &closure) {
+  return ObjectHolder::Own(Runtime::Bool{
+      comparator(left->Execute(closure), right->Execute(closure))
+  });
+}
+
+NewInstance::NewInstance(const Runtime::Class &class_, StatementList args)
+    : Statement(Kind::kNewInstance), class_(class_), args(args) {}
+
+NewInstance::NewInstance(const Runtime::Class &class_)
+    : NewInstance(class_, {}) {}
+
+ObjectHolder NewInstance::Execute(Runtime::Closure &closure) {
+  ObjectHolder instance = Runtime::ClassInstance::Create(class_);
+  auto *new_instance = instance.TryAs<Runtime::ClassInstance>();
+  auto *init = class_.GetOperator(Runtime::Operator::kInit);
+  if (init && init->formal_params.size() == args.size()) {
+    Arguments actual_args(args, closure);
+    new_instance->Call(*init, actual_args.Values());
+  }
+
+  return instance;
+}
+
+} /* namespace Ast */
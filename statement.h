@@ -1,255 +1,566 @@
-#pragma once
-
-#include "object_holder.h"
-#include "object.h"
-
-#include <unordered_map>
-#include <string>
-#include <functional>
-#include <memory>
-#include <vector>
-
-class TestRunner;
-
-namespace Ast {
-
-struct Statement {
-  virtual ~Statement() = default;
-  virtual ObjectHolder Execute(Runtime::Closure &closure) = 0;
-};
-
-template<typename T>
-struct ValueStatement : Statement {
-  explicit ValueStatement(T v) : value(std::move(v)) {}
-
-  ObjectHolder Execute(Runtime::Closure &) override {
-    return ObjectHolder::Share(value);
-  }
-
-  T value;
-};
-
-using NumericConst = ValueStatement<Runtime::Number>;
-using StringConst = ValueStatement<Runtime::String>;
-using BoolConst = ValueStatement<Runtime::Bool>;
-
-struct VariableValue : Statement {
-  std::vector<std::string> dotted_ids;
-
-  explicit VariableValue(std::string var_name);
-  explicit VariableValue(std::vector<std::string> dotted_ids);
-
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-struct Assignment : Statement {
-  std::string var_name;
-  std::unique_ptr<Statement> right_value;
-
-  Assignment(std::string var, std::unique_ptr<Statement> rv);
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-struct FieldAssignment : Statement {
-  VariableValue object;
-  std::string field_name;
-  std::unique_ptr<Statement> right_value;
-
-  FieldAssignment(VariableValue object,
-                  std::string field_name,
-                  std::unique_ptr<Statement> rv);
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-struct None : Statement {
-  ObjectHolder Execute(Runtime::Closure &) override {
-    return ObjectHolder{};
-  }
-};
-
-class Print : public Statement {
- public:
-  explicit Print(std::unique_ptr<Statement> argument);
-  explicit Print(std::vector<std::unique_ptr<Statement>> args);
-
-  static std::unique_ptr<Print> Variable(std::string name);
-
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-
-  static void SetOutputStream(std::ostream &output_stream);
-
- private:
-  std::vector<std::unique_ptr<Statement>> args;
-  static std::ostream *output;
-};
-
-struct MethodCall : Statement {
-  std::unique_ptr<Statement> object;
-  std::string method;
-  std::vector<std::unique_ptr<Statement>> args;
-
-  MethodCall(
-      std::unique_ptr<Statement> object,
-      std::string method,
-      std::vector<std::unique_ptr<Statement>> args
-  );
-
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-struct NewInstance : Statement {
-  const Runtime::Class &class_;
-  std::vector<std::unique_ptr<Statement>> args;
-
-  NewInstance(const Runtime::Class &class_);
-  NewInstance(const Runtime::Class &class_,
-              std::vector<std::unique_ptr<Statement>> args);
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-class UnaryOperation : public Statement {
- public:
-  UnaryOperation(std::unique_ptr<Statement> argument) {
-    this->argument = std::move(argument);
-  }
-
- protected:
-  std::unique_ptr<Statement> argument;
-};
-
-class Stringify : public UnaryOperation {
- public:
-  using UnaryOperation::UnaryOperation;
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-class BinaryOperation : public Statement {
- public:
-  BinaryOperation(std::unique_ptr<Statement> lhs,
-                  std::unique_ptr<Statement> rhs)
-      : lhs(std::move(lhs)), rhs(std::move(rhs)) {
-  }
-
- protected:
-  std::unique_ptr<Statement> lhs, rhs;
-};
-
-class Add : public BinaryOperation {
- public:
-  using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-class Sub : public BinaryOperation {
- public:
-  using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-class Mult : public BinaryOperation {
- public:
-  using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-class Div : public BinaryOperation {
- public:
-  using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-class Or : public BinaryOperation {
- public:
-  using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-class And : public BinaryOperation {
- public:
-  using BinaryOperation::BinaryOperation;
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-class Not : public UnaryOperation {
- public:
-  using UnaryOperation::UnaryOperation;
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-};
-
-class Compound : public Statement {
- public:
-  template<typename ...Args>
-  explicit Compound(Args &&...args) {
-    (statements.push_back(std::forward<Args>(args)), ...);
-  }
-
-  void AddStatement(std::unique_ptr<Statement> stmt) {
-    statements.push_back(std::move(stmt));
-  }
-
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-
- private:
-  std::vector<std::unique_ptr<Statement>> statements;
-};
-
-class Return : public Statement {
- public:
-  explicit Return(std::unique_ptr<Statement> statement)
-      : statement(std::move(statement)) {
-  }
-
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-
- private:
-  std::unique_ptr<Statement> statement;
-};
-
-class ClassDefinition : public Statement {
- public:
-  explicit ClassDefinition(ObjectHolder cls);
-
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-
- private:
-  const std::string &class_name;
-  ObjectHolder cls;
-};
-
-class IfElse : public Statement {
- public:
-  IfElse(
-      std::unique_ptr<Statement> condition,
-      std::unique_ptr<Statement> if_body,
-      std::unique_ptr<Statement> else_body
-  );
-
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-
- private:
-  std::unique_ptr<Statement> condition, if_body, else_body;
-};
-
-class Comparison : public Statement {
- public:
-  using Comparator = std::function<bool(const ObjectHolder &,
-                                        const ObjectHolder &)>;
-
-  Comparison(
-      Comparator cmp,
-      std::unique_ptr<Statement> lhs, std::unique_ptr<Statement> rhs
-  );
-
-  ObjectHolder Execute(Runtime::Closure &closure) override;
-
- private:
-  Comparator comparator;
-  std::unique_ptr<Statement> left, right;
-};
-
-void RunUnitTests(TestRunner &tr);
-
-}
-
-using Statement = Ast::Statement;
-
+#pragma once
+
+#include "arena.h"
+#include "inline_cache.h"
+#include "object_holder.h"
+#include "object.h"
+
+#include <deque>
+#include <span>
+#include <type_traits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <vector>
+
+class TestRunner;
+
+namespace Ast {
+
+template<typename T>
+struct ValueStatement;
+struct VariableValue;
+struct Assignment;
+struct FieldAssignment;
+struct None;
+class Print;
+struct MethodCall;
+struct NewInstance;
+class Stringify;
+class Add;
+class Sub;
+class Mult;
+class Div;
+class Or;
+class And;
+class Not;
+class Compound;
+class Return;
+class ClassDefinition;
+class IfElse;
+class Comparison;
+
+// Read-only traversal of the tree, used by passes that translate it into
+// other representations.
+class Visitor {
+ public:
+  virtual ~Visitor() = default;
+
+  virtual void Visit(const ValueStatement<Runtime::Number> &node) = 0;
+  virtual void Visit(const ValueStatement<Runtime::String> &node) = 0;
+  virtual void Visit(const ValueStatement<Runtime::Bool> &node) = 0;
+  virtual void Visit(const VariableValue &node) = 0;
+  virtual void Visit(const Assignment &node) = 0;
+  virtual void Visit(const FieldAssignment &node) = 0;
+  virtual void Visit(const None &node) = 0;
+  virtual void Visit(const Print &node) = 0;
+  virtual void Visit(const MethodCall &node) = 0;
+  virtual void Visit(const NewInstance &node) = 0;
+  virtual void Visit(const Stringify &node) = 0;
+  virtual void Visit(const Add &node) = 0;
+  virtual void Visit(const Sub &node) = 0;
+  virtual void Visit(const Mult &node) = 0;
+  virtual void Visit(const Div &node) = 0;
+  virtual void Visit(const Or &node) = 0;
+  virtual void Visit(const And &node) = 0;
+  virtual void Visit(const Not &node) = 0;
+  virtual void Visit(const Compound &node) = 0;
+  virtual void Visit(const Return &node) = 0;
+  virtual void Visit(const ClassDefinition &node) = 0;
+  virtual void Visit(const IfElse &node) = 0;
+  virtual void Visit(const Comparison &node) = 0;
+};
+
+// Concrete type of a node, so that executors can dispatch without RTTI.
+enum class Kind : uint8_t {
+  kNumericConst,
+  kStringConst,
+  kBoolConst,
+  kVariableValue,
+  kAssignment,
+  kFieldAssignment,
+  kNone,
+  kPrint,
+  kMethodCall,
+  kNewInstance,
+  kStringify,
+  kAdd,
+  kSub,
+  kMult,
+  kDiv,
+  kOr,
+  kAnd,
+  kNot,
+  kCompound,
+  kReturn,
+  kClassDefinition,
+  kIfElse,
+  kComparison,
+  // A method body run by another engine.
+  kEngineBody,
+};
+
+// How a statement of a block finished: by running to its end, or by a return,
+// which ends the enclosing method (or program) with its value.
+struct Completion {
+  ObjectHolder value;
+  bool returned = false;
+};
+
+// Nodes are placed in a Program's arena and never destroyed individually:
+// they hold no owning members. Names point into the symbol table, child lists
+// and strings into the arena, literals and classes into the Program.
+struct Statement {
+  explicit Statement(Kind kind) : kind(kind) {
+  }
+  virtual ~Statement() = default;
+  // The value of an expression. For a block, the value it returned, or None.
+  virtual ObjectHolder Execute(Runtime::Closure &closure) = 0;
+  virtual void Accept(Visitor &visitor) const = 0;
+
+  const Kind kind;
+};
+
+// Runs a statement of a block: a return, or a block that ran one, completes
+// with the returned value; anything else runs to its end and its value is
+// dropped.
+Completion ExecuteStatement(Statement &statement, Runtime::Closure &closure);
+
+#define MYTHON_ACCEPT \
+  void Accept(Visitor &visitor) const override { visitor.Visit(*this); }
+
+using StatementList = std::span<Statement *const>;
+
+// Method body of a class rebuilt by another engine, which runs it.
+struct EngineBody : Statement {
+  explicit EngineBody(const void *engine)
+      : Statement(Kind::kEngineBody), engine(engine) {
+  }
+
+  // Identifies the executor that runs the body.
+  const void *const engine;
+};
+
+template<typename T>
+constexpr Kind kValueKind = std::is_same_v<T, Runtime::Number>
+    ? Kind::kNumericConst
+    : std::is_same_v<T, Runtime::String> ? Kind::kStringConst
+                                         : Kind::kBoolConst;
+
+template<typename T>
+struct ValueStatement : Statement {
+  explicit ValueStatement(const ObjectHolder &v)
+      : Statement(kValueKind<T>), value(v) {}
+
+  ObjectHolder Execute(Runtime::Closure &) override {
+    return value;
+  }
+  MYTHON_ACCEPT
+
+  const ObjectHolder &value;
+};
+
+using NumericConst = ValueStatement<Runtime::Number>;
+using StringConst = ValueStatement<Runtime::String>;
+using BoolConst = ValueStatement<Runtime::Bool>;
+
+struct VariableValue : Statement {
+  std::span<const std::string_view> dotted_ids;
+  // Interned dotted_ids[1], if there is one.
+  Runtime::Symbol field;
+
+  explicit VariableValue(std::span<const std::string_view> dotted_ids);
+
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+
+ private:
+  Runtime::FieldCache cache;
+};
+
+struct Assignment : Statement {
+  std::string_view var_name;
+  Statement *right_value;
+
+  Assignment(std::string_view var, Statement *rv);
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+};
+
+struct FieldAssignment : Statement {
+  VariableValue object;
+  std::string_view field_name;
+  Runtime::Symbol field;
+  Statement *right_value;
+
+  FieldAssignment(VariableValue object,
+                  std::string_view field_name,
+                  Statement *rv);
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+
+ private:
+  Runtime::FieldCache cache;
+};
+
+struct None : Statement {
+  None() : Statement(Kind::kNone) {
+  }
+
+  ObjectHolder Execute(Runtime::Closure &) override {
+    return ObjectHolder{};
+  }
+  MYTHON_ACCEPT
+};
+
+class Print : public Statement {
+ public:
+  explicit Print(StatementList args);
+
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+
+  static void SetOutputStream(std::ostream &output_stream);
+  static std::ostream &OutputStream();
+
+  StatementList Args() const {
+    return args;
+  }
+
+ private:
+  StatementList args;
+  static std::ostream *output;
+};
+
+struct MethodCall : Statement {
+  Statement *object;
+  std::string_view method;
+  Runtime::Symbol selector;
+  StatementList args;
+
+  MethodCall(Statement *object, std::string_view method, StatementList args);
+
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+
+  // Hits and misses of every call site's cache, for all programs run by
+  // the tree walker. Not synchronized: programs are run on one thread.
+  static Runtime::CacheStats &Stats();
+
+ private:
+  Runtime::InlineCache cache;
+  static Runtime::CacheStats stats;
+};
+
+struct NewInstance : Statement {
+  const Runtime::Class &class_;
+  StatementList args;
+
+  NewInstance(const Runtime::Class &class_);
+  NewInstance(const Runtime::Class &class_, StatementList args);
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+};
+
+class UnaryOperation : public Statement {
+ public:
+  UnaryOperation(Kind kind, Statement *argument)
+      : Statement(kind), argument(argument) {
+  }
+
+  const Statement &Argument() const {
+    return *argument;
+  }
+
+ protected:
+  Statement *argument;
+};
+
+class Stringify : public UnaryOperation {
+ public:
+  explicit Stringify(Statement *argument)
+      : UnaryOperation(Kind::kStringify, argument) {
+  }
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+};
+
+class BinaryOperation : public Statement {
+ public:
+  BinaryOperation(Kind kind, Statement *lhs, Statement *rhs)
+      : Statement(kind), lhs(lhs), rhs(rhs) {
+  }
+
+  const Statement &Lhs() const {
+    return *lhs;
+  }
+
+  const Statement &Rhs() const {
+    return *rhs;
+  }
+
+ protected:
+  Statement *lhs, *rhs;
+};
+
+class Add : public BinaryOperation {
+ public:
+  Add(Statement *lhs, Statement *rhs)
+      : BinaryOperation(Kind::kAdd, lhs, rhs) {
+  }
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+};
+
+class Sub : public BinaryOperation {
+ public:
+  Sub(Statement *lhs, Statement *rhs)
+      : BinaryOperation(Kind::kSub, lhs, rhs) {
+  }
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+};
+
+class Mult : public BinaryOperation {
+ public:
+  Mult(Statement *lhs, Statement *rhs)
+      : BinaryOperation(Kind::kMult, lhs, rhs) {
+  }
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+};
+
+class Div : public BinaryOperation {
+ public:
+  Div(Statement *lhs, Statement *rhs)
+      : BinaryOperation(Kind::kDiv, lhs, rhs) {
+  }
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+};
+
+class Or : public BinaryOperation {
+ public:
+  Or(Statement *lhs, Statement *rhs)
+      : BinaryOperation(Kind::kOr, lhs, rhs) {
+  }
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+};
+
+class And : public BinaryOperation {
+ public:
+  And(Statement *lhs, Statement *rhs)
+      : BinaryOperation(Kind::kAnd, lhs, rhs) {
+  }
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+};
+
+class Not : public UnaryOperation {
+ public:
+  explicit Not(Statement *argument) : UnaryOperation(Kind::kNot, argument) {
+  }
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+};
+
+class Compound : public Statement {
+ public:
+  explicit Compound(StatementList statements)
+      : Statement(Kind::kCompound), statements(statements) {
+  }
+
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+
+  // Runs the statements up to the end or the first return.
+  Completion Run(Runtime::Closure &closure);
+
+  StatementList Statements() const {
+    return statements;
+  }
+
+ private:
+  StatementList statements;
+};
+
+class Return : public Statement {
+ public:
+  explicit Return(Statement *statement)
+      : Statement(Kind::kReturn), statement(statement) {
+  }
+
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+
+  const Statement &Value() const {
+    return *statement;
+  }
+
+ private:
+  Statement *statement;
+};
+
+class ClassDefinition : public Statement {
+ public:
+  explicit ClassDefinition(const ObjectHolder &cls);
+
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+
+  const ObjectHolder &Class() const {
+    return cls;
+  }
+
+ private:
+  const std::string &class_name;
+  const ObjectHolder &cls;
+};
+
+class IfElse : public Statement {
+ public:
+  IfElse(Statement *condition, Statement *if_body, Statement *else_body);
+
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+
+  // Runs the branch the condition picks as a statement of the block.
+  Completion Run(Runtime::Closure &closure);
+
+  const Statement &Condition() const {
+    return *condition;
+  }
+
+  const Statement &IfBody() const {
+    return *if_body;
+  }
+
+  // nullptr if there is no else branch
+  const Statement *ElseBody() const {
+    return else_body;
+  }
+
+ private:
+  Statement *condition, *if_body, *else_body;
+};
+
+class Comparison : public Statement {
+ public:
+  using Comparator = bool (*)(ObjectHolder, ObjectHolder);
+
+  Comparison(Comparator cmp, Statement *lhs, Statement *rhs);
+
+  ObjectHolder Execute(Runtime::Closure &closure) override;
+  MYTHON_ACCEPT
+
+  Comparator GetComparator() const {
+    return comparator;
+  }
+
+  const Statement &Left() const {
+    return *left;
+  }
+
+  const Statement &Right() const {
+    return *right;
+  }
+
+ private:
+  Comparator comparator;
+  Statement *left, *right;
+};
+
+// A parsed program: the statement tree lives in the arena and goes away with
+// it in one step; literals and classes are kept in pools next to it. The
+// Program must outlive any closure its classes were defined in.
+class Program {
+ public:
+  Program() = default;
+  Program(const Program &) = delete;
+  Program &operator=(const Program &) = delete;
+
+  Arena &GetArena() {
+    return arena_;
+  }
+
+  const ObjectHolder &AddConstant(ObjectHolder value) {
+    return constants_.emplace_back(std::move(value));
+  }
+
+  const ObjectHolder &AddClass(ObjectHolder cls) {
+    return classes_.emplace_back(std::move(cls));
+  }
+
+  const std::deque<ObjectHolder> &Classes() const {
+    return classes_;
+  }
+
+  Statement *Root() const {
+    return root_;
+  }
+
+  void SetRoot(Statement *root) {
+    root_ = root;
+  }
+
+  ObjectHolder Execute(Runtime::Closure &closure) {
+    return root_->Execute(closure);
+  }
+
+  // Keeps a separately parsed program whose nodes this one links to.
+  // Rewinding to a mark drops the nodes and literals added since. Classes
+  // can't be dropped: nothing defining one may be added after the mark.
+  struct Mark {
+    Arena::Mark arena;
+    size_t constants;
+    size_t classes;
+  };
+
+  Mark GetMark() const {
+    return {arena_.GetMark(), constants_.size(), classes_.size()};
+  }
+  void Rewind(const Mark &mark) {
+    arena_.Rewind(mark.arena);
+    constants_.resize(mark.constants);
+  }
+
+  void Adopt(std::unique_ptr<Program> part) {
+    parts_.push_back(std::move(part));
+  }
+
+  // Classes by name, kept after a lazy parse for the method bodies it
+  // deferred, along with the text they are cut from.
+  Runtime::Closure &DeclaredClasses() {
+    return declared_classes_;
+  }
+
+  // Position of each declared class in Classes(), so that a deferred body
+  // sees only the classes declared before it.
+  std::unordered_map<std::string_view, size_t> &ClassPositions() {
+    return class_positions_;
+  }
+
+  void Retain(std::shared_ptr<const void> storage) {
+    storage_ = std::move(storage);
+  }
+
+ private:
+  Arena arena_;
+  std::deque<ObjectHolder> constants_;
+  std::deque<ObjectHolder> classes_;
+  Statement *root_ = nullptr;
+  std::vector<std::unique_ptr<Program>> parts_;
+  Runtime::Closure declared_classes_;
+  std::unordered_map<std::string_view, size_t> class_positions_;
+  std::shared_ptr<const void> storage_;
+};
+
+#undef MYTHON_ACCEPT
+
+void RunUnitTests(TestRunner &tr);
+
+}
+
+using Statement = Ast::Statement;
@@ -0,0 +1,47 @@
+#include "symbol_table.h"
+
+#include <mutex>
+
+using namespace std;
+
+namespace Runtime {
+
+SymbolTable &SymbolTable::Global() {
+  static SymbolTable table;
+  return table;
+}
+
+SymbolTable::SymbolTable() {
+  // kNoSymbol
+  names_.emplace_back();
+}
+
+Symbol SymbolTable::Intern(string_view name) {
+  {
+    shared_lock lock(mutex_);
+    if (auto it = ids_.find(name); it != ids_.end()) {
+      return it->second;
+    }
+  }
+
+  unique_lock lock(mutex_);
+  if (auto it = ids_.find(name); it != ids_.end()) {
+    return it->second;
+  }
+  auto symbol = static_cast<Symbol>(names_.size());
+  const string &stored = names_.emplace_back(name);
+  ids_.emplace(stored, symbol);
+  return symbol;
+}
+
+string_view SymbolTable::Name(Symbol symbol) const {
+  shared_lock lock(mutex_);
+  return names_.at(symbol);
+}
+
+size_t SymbolTable::Size() const {
+  shared_lock lock(mutex_);
+  return names_.size();
+}
+
+} /* namespace Runtime */
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Runtime {
+
+// Small integer standing for an identifier. Equal names always get the same
+// symbol, so the parser and the runtime can compare and index by it instead of
+// hashing strings.
+using Symbol = uint32_t;
+
+constexpr Symbol kNoSymbol = 0;
+
+// Process-wide identifier interner. Safe to use from several threads at once.
+class SymbolTable {
+ public:
+  static SymbolTable &Global();
+
+  Symbol Intern(std::string_view name);
+  // The view stays valid for the lifetime of the table.
+  std::string_view Name(Symbol symbol) const;
+  size_t Size() const;
+
+ private:
+  SymbolTable();
+
+  mutable std::shared_mutex mutex_;
+  std::unordered_map<std::string_view, Symbol> ids_;
+  std::deque<std::string> names_;
+};
+
+inline Symbol Intern(std::string_view name) {
+  return SymbolTable::Global().Intern(name);
+}
+
+} /* namespace Runtime */
@@ -0,0 +1,76 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace Parse {
+
+ThreadPool::ThreadPool(size_t threads) {
+  if (threads == 0) {
+    threads = max(1u, thread::hardware_concurrency());
+  }
+  workers_.reserve(threads);
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back([this] { Work(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard lock(mutex_);
+    stopping_ = true;
+  }
+  task_ready_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Submit(function<void()> task) {
+  {
+    lock_guard lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  task_ready_.notify_one();
+}
+
+void ThreadPool::Wait() {
+  unique_lock lock(mutex_);
+  idle_.wait(lock, [this] { return tasks_.empty() && running_ == 0; });
+  if (error_) {
+    rethrow_exception(exchange(error_, nullptr));
+  }
+}
+
+void ThreadPool::Work() {
+  unique_lock lock(mutex_);
+  while (true) {
+    task_ready_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+    if (tasks_.empty()) {
+      return;
+    }
+    function<void()> task = std::move(tasks_.front());
+    tasks_.pop_front();
+    ++running_;
+
+    lock.unlock();
+    exception_ptr error;
+    try {
+      task();
+    } catch (...) {
+      error = current_exception();
+    }
+    lock.lock();
+
+    if (error && !error_) {
+      error_ = error;
+    }
+    if (--running_ == 0 && tasks_.empty()) {
+      idle_.notify_all();
+    }
+  }
+}
+
+} /* namespace Parse */
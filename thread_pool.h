@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Parse {
+
+// Fixed set of worker threads running submitted tasks in FIFO order. Tasks
+// may submit more tasks. An exception escaping a task is kept (the first one
+// only) and rethrown by Wait; the tasks already queued still run.
+class ThreadPool {
+ public:
+  // Zero means one thread per hardware core.
+  explicit ThreadPool(size_t threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void Submit(std::function<void()> task);
+  // Blocks until the queue is empty and no task is running.
+  void Wait();
+
+  size_t Size() const {
+    return workers_.size();
+  }
+
+ private:
+  void Work();
+
+  std::mutex mutex_;
+  std::condition_variable task_ready_;
+  std::condition_variable idle_;
+  std::deque<std::function<void()>> tasks_;
+  size_t running_ = 0;
+  bool stopping_ = false;
+  std::exception_ptr error_;
+  std::vector<std::thread> workers_;
+};
+
+} /* namespace Parse */
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace Runtime {
+
+// Concrete type of an object, set when it is made. Lets the runtime tell
+// objects apart without RTTI.
+enum class ObjectType : uint8_t {
+  kNone,  // only reported by ObjectHolder::Type for an empty holder
+  kString,
+  kNumber,
+  kBool,
+  kClass,
+  kClassInstance,
+  kOther,
+};
+
+class Object {
+ public:
+  explicit Object(ObjectType type) : type_(type) {}
+  virtual ~Object() = default;
+  virtual void Print(std::ostream &os) = 0;
+  [[nodiscard]]virtual bool IsTrue() const = 0;
+
+  ObjectType GetType() const {
+    return type_;
+  }
+
+ private:
+  ObjectType type_;
+};
+
+template<typename T>
+class ValueObject : public Object {
+ public:
+  ValueObject(ObjectType type, T v) : Object(type), value(v) {}
+
+  void Print(std::ostream &os) override {
+    os << value;
+  }
+
+  const T &GetValue() const {
+    return value;
+  }
+
+  virtual bool IsTrue() const override {
+    return false;
+  }
+
+ private:
+  T value;
+
+  friend class Bool;
+  friend class Number;
+};
+
+class String : public Object {
+ public:
+  static constexpr ObjectType kType = ObjectType::kString;
+
+  String(std::string v) : Object(kType), value_(std::move(v)) {}
+
+  // lhs followed by rhs. A long result is kept in a buffer with room to
+  // spare, and a string at the end of its buffer is appended to in place, so
+  // building a string by repeated concatenation copies each piece once.
+  static String Concat(const String &lhs, const String &rhs);
+
+  void Print(std::ostream &os) override {
+    os << GetValue();
+  }
+
+  std::string_view GetValue() const {
+    return buffer_ ? std::string_view(buffer_->data.get(), size_) : value_;
+  }
+
+  bool IsTrue() const override {
+    return (!GetValue().empty());
+  }
+
+ private:
+  // Characters shared by a concatenation and the strings made by appending
+  // to it, each seeing the first characters it was made with.
+  struct Buffer {
+    explicit Buffer(size_t capacity);
+
+    std::unique_ptr<char[]> data;
+    size_t capacity;
+    // Characters taken by the strings sharing the buffer.
+    std::atomic<size_t> size = 0;
+  };
+
+  String(std::shared_ptr<Buffer> buffer, size_t size)
+      : Object(kType), buffer_(std::move(buffer)), size_(size) {}
+
+  std::string value_;
+  std::shared_ptr<Buffer> buffer_;
+  size_t size_ = 0;
+};
+
+class Number : public ValueObject<int> {
+ public:
+  static constexpr ObjectType kType = ObjectType::kNumber;
+
+  Number(int v) : ValueObject(kType, v) {}
+
+  bool IsTrue() const override {
+    return (GetValue() != 0);
+  }
+};
+
+class Bool : public ValueObject<bool> {
+ public:
+  static constexpr ObjectType kType = ObjectType::kBool;
+
+  Bool(bool v) : ValueObject(kType, v) {}
+
+  void Print(std::ostream &os) override;
+  bool IsTrue() const override {
+    return GetValue();
+  }
+};
+
+} /* namespace Runtime */